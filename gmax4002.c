@@ -5,16 +5,28 @@
  */
 
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/gpio/consumer.h>
 #include <linux/i2c.h>
+#include <linux/interrupt.h>
+#include <linux/iopoll.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/of_device.h>
 #include <linux/of_graph.h>
 #include <linux/pm_runtime.h>
+#include <linux/property.h>
+#include <linux/regmap.h>
 #include <linux/regulator/consumer.h>
+#include <linux/sched/signal.h>
+#include <linux/seq_file.h>
 #include <linux/unaligned.h>
+#include <linux/workqueue.h>
 
+#include <media/mipi-csi2.h>
 #include <media/v4l2-cci.h>
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
@@ -22,46 +34,274 @@
 #include <media/v4l2-fwnode.h>
 #include <media/v4l2-mediabus.h>
 
+#define CREATE_TRACE_POINTS
+#include "gmax4002_trace.h"
+
 /* --------------------------------------------------------------------------
  * Registers / limits
  * --------------------------------------------------------------------------
  */
-#define GMAX4002_STREAM_DELAY_US          25000
-#define GMAX4002_STREAM_DELAY_RANGE_US    1000
+/*
+ * Power-up readiness. Each phase sleeps for its datasheet floor. Only XCLR
+ * has a real ready signal, the I2C ACK, and is polled after the floor until
+ * the timeout expires; the sensor reports no status for the others.
+ */
+#define GMAX4002_READY_POLL_US            500
 
-/* Initialisation delay between XCLR low->high and the moment sensor is ready */
+/* The sensor NAKs I2C until it leaves reset after XCLR low->high */
 #define GMAX4002_XCLR_MIN_DELAY_US        10000
-#define GMAX4002_XCLR_DELAY_RANGE_US      1000
+#define GMAX4002_XCLR_TIMEOUT_US          20000
+
+/* Clock settle after the common table, no lock indicator to poll */
+#define GMAX4002_CLK_SETTLE_US            10000
+
+/* PWR_UP_EN to analog ready, datasheet minimum is 80 ms */
+#define GMAX4002_PWR_UP_MIN_DELAY_US      80000
+
+/* STREAM_EN to the output being enabled */
+#define GMAX4002_STREAM_MIN_DELAY_US      25000
+
+/*
+ * STREAM_EN cleared to the frame in flight being read out, checked by the
+ * frame counter standing still for a frame period. The counter is polled
+ * in short steps and long frame lengths are not waited for past the cap.
+ */
+#define GMAX4002_STOP_MIN_PERIOD_US       1000
+#define GMAX4002_STOP_POLL_US             2000
+#define GMAX4002_STOP_TIMEOUT_US          500000
 
 
 /* Exposure control (lines) */
-/* The driver is set to use external exposure, it will still report the control but it actuall does nothing. */
+/* In external exposure mode the control is still reported but it actually does nothing. */
 #define GMAX4002_EXPOSURE_MIN             1000
 #define GMAX4002_EXPOSURE_STEP            1000
 #define GMAX4002_EXPOSURE_DEFAULT         1000
 #define GMAX4002_EXPOSURE_MAX             1000
 
-/* Black level control */
+/* Integration time (lines), used by the internally timed sync modes */
+#define GMAX4002_REG_EXPOSURE             CCI_REG24_LE(0x2E27)
+#define GMAX4002_INT_EXPOSURE_MIN         1
+#define GMAX4002_INT_EXPOSURE_OFFSET      4
+#define GMAX4002_INT_EXPOSURE_DEFAULT     1600
+
+/* Frame length (lines), used by the internally timed sync modes */
+#define GMAX4002_REG_FRAME_LENGTH         CCI_REG24_LE(0x2E24)
+#define GMAX4002_FRAME_LENGTH_MAX         0xFFFFFF
+#define GMAX4002_FRAME_LENGTH_DEFAULT     3333
+#define GMAX4002_VBLANK_MIN               32
+/* Placeholder range reported in external exposure mode */
+#define GMAX4002_VBLANK_MAX               0xFFFFF
+
+/* Line length in pixel clocks, 5 us per line at the 10-bit pixel rate */
+#define GMAX4002_LINE_LENGTH              2400
+
+/* Frame sync / exposure source */
+#define GMAX4002_REG_SYNC_MODE            CCI_REG8(0x2E01)
+
+/* Black level control, in 10-bit ADC codes, default as in mode_common_regs */
 #define GMAX4002_REG_BLKLEVEL             CCI_REG16_LE(0x305B)
-#define GMAX4002_BLKLEVEL_DEFAULT         50
+#define GMAX4002_BLKLEVEL_MAX             1023
+#define GMAX4002_BLKLEVEL_DEFAULT         16
+#define GMAX4002_BLKLEVEL_BPP             10
 
-/* Analog gain control */
+/*
+ * Gain control. Both controls are linear in 1/256 units, the analogue gain
+ * is split into the PGA step below it and a digital residual.
+ */
 #define GMAX4002_REG_ANALOG_GAIN          CCI_REG8(0x2EC9)
-#define GMAX4002_ANA_GAIN_MIN             0
-#define GMAX4002_ANA_GAIN_MAX             15
+#define GMAX4002_ANA_GAIN_MIN             256
+#define GMAX4002_ANA_GAIN_MAX             2048
 #define GMAX4002_ANA_GAIN_STEP            1
-#define GMAX4002_ANA_GAIN_DEFAULT         0
+#define GMAX4002_ANA_GAIN_DEFAULT         256
+#define GMAX4002_REG_DIGITAL_GAIN         CCI_REG16_LE(0x2ECC)
+#define GMAX4002_DGTL_GAIN_MIN            256
+#define GMAX4002_DGTL_GAIN_MAX            4095
+#define GMAX4002_DGTL_GAIN_STEP           1
+#define GMAX4002_DGTL_GAIN_DEFAULT        256
+#define GMAX4002_GAIN_UNITY               256
+
+/* Linear gain of each 0x2EC9 code, in 1/256 units */
+static const u16 gmax4002_again_steps[] = {
+    256, 288, 320, 352, 384, 448, 512, 576,
+    640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+};
+
+/* Sensor control */
+#define GMAX4002_REG_CTRL0                CCI_REG8(0x2E00)
+#define GMAX4002_CLK_STABLE_EN            BIT(0)
+#define GMAX4002_STREAM_EN                BIT(1)
+
+/* Array sync: XVS pulse output of the master, trigger delay of a slave */
+#define GMAX4002_REG_SYNC_OUT             CCI_REG8(0x2E04)
+#define GMAX4002_SYNC_OUT_EN              0x01
+#define GMAX4002_REG_TRIG_DELAY           CCI_REG16_LE(0x2E1C)
+#define GMAX4002_TRIG_DELAY_MAX           0xFFFF
+
+/* Group hold, timing and gain writes latch together at the next frame start */
+#define GMAX4002_REG_GRP_HOLD             CCI_REG8(0x2E02)
+#define GMAX4002_GRP_HOLD_EN              0x01
+
+/* Analog power up */
+#define GMAX4002_REG_PWR_UP               CCI_REG8(0x3301)
+#define GMAX4002_PWR_UP_EN                0x01
+
+/*
+ * Read-modify-written by the power-up handshake, which has to start from
+ * their table values. Volatile, so a cache sync never replays the values
+ * the handshake left behind.
+ */
+#define GMAX4002_REG_ANALOG_SEQ0          CCI_REG8(0x3023)
+#define GMAX4002_REG_ANALOG_SEQ1          CCI_REG8(0x3024)
 
 /* Vertical Flip */
 #define GMAX4002_REG_FLIP_H            CCI_REG8(0x3002)
 #define GMAX4002_REG_FLIP_V            CCI_REG8(0x2E05)
 
-/* Pixel rate helper (sensor line clock proxy used below) */
-#define GMAX4002_PIXEL_RATE               60000000U
-#define GMAX4002_LINK_FREQ               600000000U
+/* CSI-2 output format */
+#define GMAX4002_REG_DATA_FORMAT          CCI_REG8(0x3001)
+#define GMAX4002_DATA_FORMAT_RAW8         0x01
+#define GMAX4002_DATA_FORMAT_RAW10        0x02
+#define GMAX4002_DATA_FORMAT_RAW12        0x03
+
+/* Highest register address, for the register cache */
+#define GMAX4002_REG_MAX                  0x3FFF
+
+/* Frames read out since power up, wraps at 16 bits */
+#define GMAX4002_REG_FRAME_COUNT          CCI_REG16_LE(0x2F00)
+#define GMAX4002_FRAME_COUNT_MAX          0xFFFF
+
+/*
+ * Embedded status line ahead of the image, CSI-2 data type 0x12. Off, as in
+ * the vendor table, unless the metadata pad is streamed.
+ */
+#define GMAX4002_REG_EMBEDDED_CTRL        CCI_REG8(0x2E0A)
+#define GMAX4002_EMBEDDED_EN              0x01
+#define GMAX4002_EMBEDDED_LINE_WIDTH      2048U
+#define GMAX4002_NUM_EMBEDDED_LINES       1U
+
+/*
+ * Dual conversion gain readout: each row is also read at low conversion
+ * gain and sent as a second image, same format, on its own virtual
+ * channel. The high gain image stays on pad 0 and VC 0. The vendor table
+ * values of both registers are the off state, the enable bit is only set
+ * on top of them.
+ */
+#define GMAX4002_REG_DUAL_GAIN            CCI_REG8(0x2E0B)
+#define GMAX4002_DUAL_GAIN_EN             BIT(1)
+#define GMAX4002_REG_DUAL_GAIN_VC         CCI_REG8(0x2E0C)
+#define GMAX4002_DUAL_GAIN_VC_OFF         0x00
+#define GMAX4002_HDR_VC                   1
+
+/*
+ * Overlapped readout: the next exposure may start while the previous frame
+ * is still read out, so a trigger period only has to cover the longer of
+ * the two instead of their sum. The vendor table sets other bits of the
+ * register, only the overlap bit is changed.
+ */
+#define GMAX4002_REG_READOUT_MODE         CCI_REG8(0x2E0E)
+#define GMAX4002_READOUT_OVERLAP          BIT(0)
+
+/*
+ * Test pattern generator, replaces the pixel data ahead of the CSI-2 packer.
+ * A pattern is selected by its menu index in the selector field. The rest of
+ * the register keeps the vendor table value, and the table value of the
+ * field is restored when disabled.
+ */
+#define GMAX4002_REG_TEST_PATTERN         CCI_REG8(0x2E0D)
+#define GMAX4002_TEST_PATTERN_SEL         GENMASK(2, 0)
+#define GMAX4002_TEST_PATTERN_OFF         0xBE
+
+static const char * const gmax4002_test_pattern_menu[] = {
+    "Disabled",
+    "Colour Bars",
+    "Horizontal Gradient",
+    "Vertical Gradient",
+    "Solid",
+    "PN9",
+};
+
+enum gmax4002_hdr_mode {
+    GMAX4002_HDR_OFF,
+    GMAX4002_HDR_DUAL_GAIN,
+};
+
+static const char * const gmax4002_hdr_menu[] = {
+    [GMAX4002_HDR_OFF] = "Off",
+    [GMAX4002_HDR_DUAL_GAIN] = "Dual Gain (VC1)",
+};
+
+enum gmax4002_pad {
+    GMAX4002_PAD_IMAGE,
+    GMAX4002_PAD_METADATA,
+    /* Low conversion gain image, only sent in GMAX4002_HDR_DUAL_GAIN */
+    GMAX4002_PAD_HDR,
+    GMAX4002_NUM_PADS,
+};
+
+/* MIPI PLL multiplier, link frequency = xclk * multiplier */
+#define GMAX4002_REG_PLL_MULT             CCI_REG8(0x300D)
+#define GMAX4002_XCLK_FREQ                40000000U
+
+/*
+ * Active CSI-2 data lanes minus one. The common table programs 4 lanes,
+ * 2 lanes is the same serializer with the upper pair left idle.
+ */
+#define GMAX4002_REG_LANE_NUM             CCI_REG8(0x3004)
 
 static const s64 gmax4002_link_freq_menu[] = {
-    GMAX4002_LINK_FREQ,
+    360000000,
+    480000000,
+    600000000,
+    720000000,
+};
+
+/* PLL multiplier for each entry of gmax4002_link_freq_menu[] */
+static const u8 gmax4002_pll_mult[] = {
+    9,
+    12,
+    15,
+    18,
+};
+
+/*
+ * Supported lane counts. The pixel rate follows from the link (lanes DDR
+ * over bits per pixel), so at 2 lanes it and with it the maximum frame rate
+ * halve; the default link frequency is raised to win some of that back.
+ */
+struct gmax4002_lane_cfg {
+    unsigned int num_lanes;
+    unsigned int link_freq_default_idx;
+    struct {
+        unsigned int num_of_regs;
+        const struct cci_reg_sequence *regs;
+    } reg_list;
+};
+
+static const struct cci_reg_sequence gmax4002_lane2_regs[] = {
+    { GMAX4002_REG_LANE_NUM, 0x01 },
+};
+
+static const struct cci_reg_sequence gmax4002_lane4_regs[] = {
+    { GMAX4002_REG_LANE_NUM, 0x03 },
+};
+
+static const struct gmax4002_lane_cfg gmax4002_lane_cfgs[] = {
+    {
+        .num_lanes = 2,
+        .link_freq_default_idx = 3,
+        .reg_list = {
+            .num_of_regs = ARRAY_SIZE(gmax4002_lane2_regs),
+            .regs = gmax4002_lane2_regs,
+        },
+    },
+    {
+        .num_lanes = 4,
+        .link_freq_default_idx = 2,
+        .reg_list = {
+            .num_of_regs = ARRAY_SIZE(gmax4002_lane4_regs),
+            .regs = gmax4002_lane4_regs,
+        },
+    },
 };
 
 
@@ -80,6 +320,22 @@ static const s64 gmax4002_link_freq_menu[] = {
 #define GMAX4002_PIXEL_ARRAY_WIDTH  2048U
 #define GMAX4002_PIXEL_ARRAY_HEIGHT 1200U
 
+/* Rows sent ahead of the readout window in every frame */
+#define GMAX4002_DUMMY_ROWS         (GMAX4002_NATIVE_HEIGHT - GMAX4002_PIXEL_ARRAY_HEIGHT)
+
+/* Readout window (rows), programmed from the active crop */
+#define GMAX4002_REG_ROI_Y_START    CCI_REG16_LE(0x2E11)
+#define GMAX4002_REG_ROI_Y_SIZE     CCI_REG16_LE(0x2E1A)
+#define GMAX4002_ROI_MIN_HEIGHT     16U
+/* Keep the Bayer phase of the window */
+#define GMAX4002_ROI_Y_ALIGN        2U
+
+/* Readout scaling, the common table leaves both off */
+#define GMAX4002_REG_SKIP_V         CCI_REG8(0x2E08)
+#define GMAX4002_SKIP_V_2X          0x01
+#define GMAX4002_REG_BINNING        CCI_REG8(0x2E09)
+#define GMAX4002_BINNING_2X2        0x01
+
 
 static const struct cci_reg_sequence mode_common_regs[] = {
 	{CCI_REG8(0x2E00),0x00},
@@ -555,30 +811,331 @@ static const struct cci_reg_sequence mode_common_regs[] = {
 };
 
 
+/*
+ * Register tables are folded into runs of consecutive addresses at probe time
+ * and uploaded as auto-increment bursts. Long runs are split so a single
+ * transfer does not hold the shared camera I2C bus for too long.
+ */
+#define GMAX4002_BURST_MAX_LEN            64
+
+struct gmax4002_reg_block {
+    u16 addr;
+    u16 len;
+    const u8 *data;
+};
+
+struct gmax4002_reg_table {
+    unsigned int num_blocks;
+    struct gmax4002_reg_block *blocks;
+};
+
+enum gmax4002_ready_phase {
+    GMAX4002_READY_XCLR,
+    GMAX4002_READY_CLK,
+    GMAX4002_READY_PWR_UP,
+    GMAX4002_READY_STREAM,
+    GMAX4002_READY_NUM,
+};
+
+struct gmax4002_ready_cfg {
+    const char *name;
+    unsigned int floor_us;
+    unsigned int timeout_us;
+    /* Register to read until it ACKs, 0 when the floor is all we have */
+    u32 reg;
+};
+
+static const struct gmax4002_ready_cfg gmax4002_ready_cfgs[GMAX4002_READY_NUM] = {
+    [GMAX4002_READY_XCLR] = {
+        .name = "xclr",
+        .floor_us = GMAX4002_XCLR_MIN_DELAY_US,
+        .timeout_us = GMAX4002_XCLR_TIMEOUT_US,
+        /* Any acknowledged read means the control interface is up */
+        .reg = GMAX4002_REG_CTRL0,
+    },
+    [GMAX4002_READY_CLK] = {
+        .name = "clk_settle",
+        .floor_us = GMAX4002_CLK_SETTLE_US,
+    },
+    [GMAX4002_READY_PWR_UP] = {
+        .name = "pwr_up",
+        .floor_us = GMAX4002_PWR_UP_MIN_DELAY_US,
+    },
+    [GMAX4002_READY_STREAM] = {
+        .name = "stream",
+        .floor_us = GMAX4002_STREAM_MIN_DELAY_US,
+    },
+};
+
+/*
+ * Timed phases of a power up and stream start, the readiness waits first.
+ * Each one keeps the last, min and max duration and a log2 histogram.
+ */
+enum gmax4002_timing_phase {
+    GMAX4002_TIMING_POWER_ON = GMAX4002_READY_NUM,
+    GMAX4002_TIMING_UPLOAD,
+    GMAX4002_TIMING_ANALOG_SEQ,
+    GMAX4002_TIMING_CTRL_SETUP,
+    GMAX4002_TIMING_STREAM_ON,
+    GMAX4002_TIMING_STOP,
+    GMAX4002_TIMING_NUM,
+};
+
+static const char * const gmax4002_timing_names[GMAX4002_TIMING_NUM] = {
+    /* Whole runtime resume, includes xclr */
+    [GMAX4002_TIMING_POWER_ON] = "power_on",
+    /* Table writes or regcache_sync, PLL and lane setup */
+    [GMAX4002_TIMING_UPLOAD] = "upload",
+    /* Read-modify-writes after pwr_up */
+    [GMAX4002_TIMING_ANALOG_SEQ] = "analog_seq",
+    [GMAX4002_TIMING_CTRL_SETUP] = "ctrl_setup",
+    /* Whole enable_streams, includes power_on when resuming */
+    [GMAX4002_TIMING_STREAM_ON] = "stream_on",
+    [GMAX4002_TIMING_STOP] = "stop",
+};
+
+/* Bucket n counts durations below 2^n us, the last one everything above */
+#define GMAX4002_TIMING_BUCKETS           22
+
+struct gmax4002_timing {
+    /* Serialises the recording paths against the histogram and reset */
+    spinlock_t lock;
+    u32 last_us;
+    u32 min_us;
+    u32 max_us;
+    u32 count;
+    u32 hist[GMAX4002_TIMING_BUCKETS];
+};
+
+/* Upper bound for one write to the benchmark trigger */
+#define GMAX4002_BENCH_MAX_CYCLES         1000
+
+/* PGA code and digital residual realising one analogue gain value */
+struct gmax4002_gain_step {
+    u8 code;
+    u16 residual;
+};
+
 /* Mode description */
 struct gmax4002_mode {
     unsigned int width;
     unsigned int height;
     struct v4l2_rect crop;
+    /* Rows of the crop per output row, 1 when not binned or skipped */
+    unsigned int vscale;
     struct {
         unsigned int num_of_regs;
         const struct cci_reg_sequence *regs;
     } reg_list;
+    /* Binning/skipping settings, written after reg_list */
+    struct {
+        unsigned int num_of_regs;
+        const struct cci_reg_sequence *regs;
+    } scale_list;
 };
 
-static struct gmax4002_mode supported_modes_10bit[] = {
-    {
-        .width = GMAX4002_NATIVE_WIDTH,
-        .height = GMAX4002_NATIVE_HEIGHT,
-        .crop = {
-            .left = GMAX4002_PIXEL_ARRAY_LEFT,
-            .top = GMAX4002_PIXEL_ARRAY_TOP,
-            .width = GMAX4002_PIXEL_ARRAY_WIDTH,
-            .height = GMAX4002_PIXEL_ARRAY_HEIGHT,
-        },
-    },
+/* Per bit depth settings applied on top of mode_common_regs */
+static const struct cci_reg_sequence mode_8bit_regs[] = {
+    { GMAX4002_REG_DATA_FORMAT, GMAX4002_DATA_FORMAT_RAW8 },
+};
+
+static const struct cci_reg_sequence mode_10bit_regs[] = {
+    { GMAX4002_REG_DATA_FORMAT, GMAX4002_DATA_FORMAT_RAW10 },
+};
+
+/*
+ * Only the CSI-2 packer changes for RAW12. The ADC resolution setting for
+ * 12 bits is not described in the available documentation, so the low bits
+ * may carry no more information than at 10 bits.
+ */
+static const struct cci_reg_sequence mode_12bit_regs[] = {
+    { GMAX4002_REG_DATA_FORMAT, GMAX4002_DATA_FORMAT_RAW12 },
+};
+
+/* 2x2 binning, keeps the Bayer pattern */
+static const struct cci_reg_sequence mode_bin2x2_regs[] = {
+    { GMAX4002_REG_BINNING, GMAX4002_BINNING_2X2 },
+};
+
+/* 2x vertical subsampling, skips every other row pair */
+static const struct cci_reg_sequence mode_skip2_regs[] = {
+    { GMAX4002_REG_SKIP_V, GMAX4002_SKIP_V_2X },
+};
+
+#define GMAX4002_REG_LIST(r) {                                                 \
+    .num_of_regs = ARRAY_SIZE(r),                                              \
+    .regs = r,                                                                 \
+}
+
+/*
+ * The output height is the readout window plus GMAX4002_DUMMY_ROWS. The
+ * windowed modes are centred on the array, readout time scales with rows.
+ * The binned and skipped modes read the full array and scale the output.
+ * Each bit depth offers the same geometries, depth_regs selects the
+ * output format.
+ */
+#define GMAX4002_MODES(depth_regs) {                                           \
+    {                                                                          \
+        .width = GMAX4002_NATIVE_WIDTH,                                        \
+        .height = GMAX4002_NATIVE_HEIGHT,                                      \
+        .crop = {                                                              \
+            .left = GMAX4002_PIXEL_ARRAY_LEFT,                                 \
+            .top = GMAX4002_PIXEL_ARRAY_TOP,                                   \
+            .width = GMAX4002_PIXEL_ARRAY_WIDTH,                               \
+            .height = GMAX4002_PIXEL_ARRAY_HEIGHT,                             \
+        },                                                                     \
+        .vscale = 1,                                                           \
+        .reg_list = GMAX4002_REG_LIST(depth_regs),                             \
+    },                                                                         \
+    {                                                                          \
+        .width = GMAX4002_NATIVE_WIDTH,                                        \
+        .height = 600,                                                         \
+        .crop = {                                                              \
+            .left = GMAX4002_PIXEL_ARRAY_LEFT,                                 \
+            .top = GMAX4002_PIXEL_ARRAY_TOP + 308,                             \
+            .width = GMAX4002_PIXEL_ARRAY_WIDTH,                               \
+            .height = 582,                                                     \
+        },                                                                     \
+        .vscale = 1,                                                           \
+        .reg_list = GMAX4002_REG_LIST(depth_regs),                             \
+    },                                                                         \
+    {                                                                          \
+        .width = GMAX4002_NATIVE_WIDTH,                                        \
+        .height = 300,                                                         \
+        .crop = {                                                              \
+            .left = GMAX4002_PIXEL_ARRAY_LEFT,                                 \
+            .top = GMAX4002_PIXEL_ARRAY_TOP + 458,                             \
+            .width = GMAX4002_PIXEL_ARRAY_WIDTH,                               \
+            .height = 282,                                                     \
+        },                                                                     \
+        .vscale = 1,                                                           \
+        .reg_list = GMAX4002_REG_LIST(depth_regs),                             \
+    },                                                                         \
+    {                                                                          \
+        .width = GMAX4002_NATIVE_WIDTH / 2,                                    \
+        .height = GMAX4002_PIXEL_ARRAY_HEIGHT / 2 + GMAX4002_DUMMY_ROWS,       \
+        .crop = {                                                              \
+            .left = GMAX4002_PIXEL_ARRAY_LEFT,                                 \
+            .top = GMAX4002_PIXEL_ARRAY_TOP,                                   \
+            .width = GMAX4002_PIXEL_ARRAY_WIDTH,                               \
+            .height = GMAX4002_PIXEL_ARRAY_HEIGHT,                             \
+        },                                                                     \
+        .vscale = 2,                                                           \
+        .reg_list = GMAX4002_REG_LIST(depth_regs),                             \
+        .scale_list = GMAX4002_REG_LIST(mode_bin2x2_regs),                     \
+    },                                                                         \
+    {                                                                          \
+        .width = GMAX4002_NATIVE_WIDTH,                                        \
+        .height = GMAX4002_PIXEL_ARRAY_HEIGHT / 2 + GMAX4002_DUMMY_ROWS,       \
+        .crop = {                                                              \
+            .left = GMAX4002_PIXEL_ARRAY_LEFT,                                 \
+            .top = GMAX4002_PIXEL_ARRAY_TOP,                                   \
+            .width = GMAX4002_PIXEL_ARRAY_WIDTH,                               \
+            .height = GMAX4002_PIXEL_ARRAY_HEIGHT,                             \
+        },                                                                     \
+        .vscale = 2,                                                           \
+        .reg_list = GMAX4002_REG_LIST(depth_regs),                             \
+        .scale_list = GMAX4002_REG_LIST(mode_skip2_regs),                      \
+    },                                                                         \
+}
+
+static const struct gmax4002_mode supported_modes_10bit[] =
+    GMAX4002_MODES(mode_10bit_regs);
+static const struct gmax4002_mode supported_modes_8bit[] =
+    GMAX4002_MODES(mode_8bit_regs);
+static const struct gmax4002_mode supported_modes_12bit[] =
+    GMAX4002_MODES(mode_12bit_regs);
+
+/*
+ * Every mode of every bit depth, in the order used to index the
+ * mode-to-mode delta tables.
+ */
+static const struct {
+    const struct gmax4002_mode *modes;
+    unsigned int num_modes;
+} gmax4002_mode_tables[] = {
+    { supported_modes_10bit, ARRAY_SIZE(supported_modes_10bit) },
+    { supported_modes_8bit, ARRAY_SIZE(supported_modes_8bit) },
+    { supported_modes_12bit, ARRAY_SIZE(supported_modes_12bit) },
+};
+
+#define GMAX4002_NUM_MODES (ARRAY_SIZE(supported_modes_10bit) + \
+                ARRAY_SIZE(supported_modes_8bit) + \
+                ARRAY_SIZE(supported_modes_12bit))
+
+enum gmax4002_sync_mode {
+    /* Trigger pulse starts the frame and its high time sets the exposure */
+    GMAX4002_SYNC_EXT_EXPOSURE,
+    /* Trigger pulse starts the frame, exposure timed by the sensor */
+    GMAX4002_SYNC_EXT_TRIGGER,
+    /* Free running, frame length and exposure timed by the sensor */
+    GMAX4002_SYNC_MASTER,
+};
+
+/* DT "sync-mode" values, indexed by enum gmax4002_sync_mode */
+static const char * const gmax4002_sync_mode_names[] = {
+    "external-exposure",
+    "external-trigger",
+    "master",
+};
+
+static const char * const gmax4002_sync_mode_menu[] = {
+    "External Exposure",
+    "External Trigger",
+    "Internal Master",
+};
+
+static const u8 gmax4002_sync_mode_regval[] = {
+    [GMAX4002_SYNC_EXT_EXPOSURE] = 0x01,
+    [GMAX4002_SYNC_EXT_TRIGGER]  = 0x02,
+    [GMAX4002_SYNC_MASTER]       = 0x00,
+};
+
+/*
+ * Role in a synchronised array. The master free-runs and drives XVS, the
+ * slaves of the same gpixel,sync-group are triggered by it.
+ */
+enum gmax4002_sync_role {
+    GMAX4002_SYNC_ROLE_NONE,
+    GMAX4002_SYNC_ROLE_MASTER,
+    GMAX4002_SYNC_ROLE_SLAVE,
+};
+
+static const char * const gmax4002_sync_role_names[] = {
+    [GMAX4002_SYNC_ROLE_NONE]   = "none",
+    [GMAX4002_SYNC_ROLE_MASTER] = "master",
+    [GMAX4002_SYNC_ROLE_SLAVE]  = "slave",
 };
 
+/* Driver private controls */
+#define V4L2_CID_GMAX4002_BASE            (V4L2_CID_USER_BASE + 0x2000)
+#define V4L2_CID_GMAX4002_SYNC_MODE       (V4L2_CID_GMAX4002_BASE + 0)
+#define V4L2_CID_GMAX4002_FRAME_COUNT     (V4L2_CID_GMAX4002_BASE + 1)
+#define V4L2_CID_GMAX4002_TRIGGERS        (V4L2_CID_GMAX4002_BASE + 2)
+#define V4L2_CID_GMAX4002_FRAMES          (V4L2_CID_GMAX4002_BASE + 3)
+#define V4L2_CID_GMAX4002_PEDESTAL        (V4L2_CID_GMAX4002_BASE + 4)
+#define V4L2_CID_GMAX4002_TRIGGER_DELAY   (V4L2_CID_GMAX4002_BASE + 5)
+#define V4L2_CID_GMAX4002_ROI_TOP         (V4L2_CID_GMAX4002_BASE + 6)
+#define V4L2_CID_GMAX4002_BURST_GAINS     (V4L2_CID_GMAX4002_BASE + 7)
+#define V4L2_CID_GMAX4002_BURST_EXPOSURES (V4L2_CID_GMAX4002_BASE + 8)
+#define V4L2_CID_GMAX4002_BURST_ARM       (V4L2_CID_GMAX4002_BASE + 9)
+#define V4L2_CID_GMAX4002_READOUT_RATE    (V4L2_CID_GMAX4002_BASE + 10)
+#define V4L2_CID_GMAX4002_MAX_READOUT_RATE (V4L2_CID_GMAX4002_BASE + 11)
+#define V4L2_CID_GMAX4002_LANE_UTIL       (V4L2_CID_GMAX4002_BASE + 12)
+#define V4L2_CID_GMAX4002_OVERLAP         (V4L2_CID_GMAX4002_BASE + 13)
+#define V4L2_CID_GMAX4002_MAX_TRIGGER_RATE (V4L2_CID_GMAX4002_BASE + 14)
+#define V4L2_CID_GMAX4002_PULSE_WIDTH     (V4L2_CID_GMAX4002_BASE + 15)
+
+/* Readout rates are reported in mHz, lane utilisation in percent */
+#define GMAX4002_RATE_MAX                 10000000
+#define GMAX4002_LANE_UTIL_MAX            1000
+
+/* Frames of one burst, one gain and exposure entry each */
+#define GMAX4002_BURST_MAX_STEPS          64
+
+/* Distinct registers the controls write, bounds one flush batch */
+#define GMAX4002_MAX_PENDING              16
+
 /* Formats exposed per mode/bit depth */
 static const u32 codes[] = {
     /* 10-bit modes. */
@@ -586,10 +1143,28 @@ static const u32 codes[] = {
     MEDIA_BUS_FMT_SGRBG10_1X10,
     MEDIA_BUS_FMT_SGBRG10_1X10,
     MEDIA_BUS_FMT_SBGGR10_1X10,
+    /* 8-bit modes. */
+    MEDIA_BUS_FMT_SRGGB8_1X8,
+    MEDIA_BUS_FMT_SGRBG8_1X8,
+    MEDIA_BUS_FMT_SGBRG8_1X8,
+    MEDIA_BUS_FMT_SBGGR8_1X8,
+    /* 12-bit modes. */
+    MEDIA_BUS_FMT_SRGGB12_1X12,
+    MEDIA_BUS_FMT_SGRBG12_1X12,
+    MEDIA_BUS_FMT_SGBRG12_1X12,
+    MEDIA_BUS_FMT_SBGGR12_1X12,
 };
 
 static const u32 mono_codes[] = {
 	MEDIA_BUS_FMT_Y10_1X10,
+	MEDIA_BUS_FMT_Y8_1X8,
+	MEDIA_BUS_FMT_Y12_1X12,
+};
+
+/* Colour filter variants, selected by the compatible string */
+enum gmax4002_variant {
+    GMAX4002_VARIANT_COLOUR,
+    GMAX4002_VARIANT_MONO,
 };
 
 /* Regulators */
@@ -606,30 +1181,165 @@ static const char * const gmax4002_supply_name[] = {
  * --------------------------------------------------------------------------
  */
 
+static int standby_timeout_ms = -1;
+module_param(standby_timeout_ms, int, 0644);
+MODULE_PARM_DESC(standby_timeout_ms,
+         "Keep the sensor powered in standby for this long after streaming stops (-1 = use DT, 0 = off)");
+
+/* A queued control write, only the bits in mask change */
+struct gmax4002_pending_write {
+    u32 reg;
+    u64 val;
+    u64 mask;
+};
+
 struct gmax4002 {
     struct v4l2_subdev sd;
-    struct media_pad pad;
+    struct media_pad pads[GMAX4002_NUM_PADS];
     struct device *dev;
     struct regmap *regmap;
 
     struct clk *xclk;
 
     struct gpio_desc *reset_gpio;
+    /* Optional input wired to the trigger line, counts frame starts */
+    struct gpio_desc *trigger_gpio;
+    int trigger_irq;
     struct regulator_bulk_data supplies[GMAX4002_NUM_SUPPLIES];
 
     struct v4l2_ctrl_handler ctrl_handler;
 
+    /* Monochrome sensor, advertises the Y formats instead of Bayer */
+    bool mono;
+
+    /* mode_common_regs compiled into burst blocks */
+    struct gmax4002_reg_table common_table;
+    /*
+     * Writes taking the sensor from the register image of one mode to
+     * that of another, indexed [from * GMAX4002_NUM_MODES + to].
+     */
+    struct gmax4002_reg_table *mode_deltas;
+
+    /* Analogue gain split, indexed by gain - GMAX4002_ANA_GAIN_MIN */
+    struct gmax4002_gain_step *gain_lut;
+
     /* Controls */
     struct v4l2_ctrl *pixel_rate;
     struct v4l2_ctrl *link_freq;
+    unsigned long link_freq_bitmap;
+    unsigned int link_freq_idx;
+    const struct gmax4002_lane_cfg *lane_cfg;
+    /* Cluster, keep together */
     struct v4l2_ctrl *exposure;
     struct v4l2_ctrl *gain;
+    struct v4l2_ctrl *dgain;
     struct v4l2_ctrl *vflip;
     struct v4l2_ctrl *hflip;
     struct v4l2_ctrl *vblank;
     struct v4l2_ctrl *hblank;
+    struct v4l2_ctrl *sync_ctrl;
+    struct v4l2_ctrl *blklevel;
+    struct v4l2_ctrl *roi_top;
+    struct v4l2_ctrl *hdr;
+    struct v4l2_ctrl *overlap;
+    struct v4l2_ctrl *pulse_width;
+
+    /*
+     * Control writes batched by set_ctrl and flushed by flush_work in one
+     * group hold, so the I2C transfers run outside the control lock.
+     * pending_lock guards the batch, flush_lock orders the flushes and
+     * keeps them out of stream start and stop.
+     */
+    struct gmax4002_pending_write pending[GMAX4002_MAX_PENDING];
+    unsigned int num_pending;
+    spinlock_t pending_lock;
+    struct mutex flush_lock;
+    struct work_struct flush_work;
+    /* A flush failed, protected by flush_lock */
+    bool flush_failed;
+    /* Set once probe can no longer fail, flushes are only queued after */
+    bool probed;
+
+    /*
+     * Frame accounting since the last stream start. frames extends the
+     * 16-bit sensor counter and is updated under the control lock on every
+     * read, so it stays exact as long as it is read every 65535 frames.
+     */
+    atomic_t triggers;
+    u16 frame_count_last;
+    u32 frames;
+    /* Interval of the last two triggers, 0 until two were seen */
+    ktime_t trigger_last;
+    u64 trigger_period_ns;
+
+    /*
+     * Output size and depth of the active format. The mode itself is looked
+     * up from the active state when needed. The size differs from the mode
+     * for a custom crop.
+     */
+    unsigned int bpp;
+    u32 frame_width;
+    u32 frame_height;
+    enum gmax4002_sync_mode sync_mode;
+
+    /*
+     * Array sync. A master only sets STREAM_EN and enables its XVS output
+     * once every slave of its group is armed, so no slave misses the
+     * first pulse, and drops XVS again when a slave stops. The armed
+     * flags are protected by gmax4002_sync_lock.
+     */
+    enum gmax4002_sync_role sync_role;
+    u32 sync_group;
+    struct list_head sync_node;
+    bool sync_armed;
+    bool sync_out;
+    struct work_struct sync_work;
+    u32 trigger_delay;
+
+    /*
+     * The register file keeps its contents until the next power off, so
+     * remember what was last uploaded to skip the table on a restart.
+     */
+    bool configured;
+    const struct gmax4002_mode *programmed_mode;
+    /*
+     * The register cache still holds the last upload but the sensor lost
+     * it in a power cycle, regcache_sync() restores it.
+     */
+    bool cache_dirty;
+    /* PWR_UP sequence done, cleared by standby */
+    bool analog_on;
+    /* Metadata pad streamed, the embedded line is sent ahead of the image */
+    bool embedded;
+
+    /*
+     * Burst sequencer: the settings of step n are written after trigger
+     * n - 1, so they latch for frame n. Armed until the next stream start
+     * when set while idle.
+     */
+    struct v4l2_ctrl *burst_gains;
+    struct v4l2_ctrl *burst_exposures;
+    struct work_struct burst_work;
+    unsigned int burst_pos;
+    /* Triggers not yet handled by burst_work */
+    atomic_t burst_due;
+    bool burst_armed;
+    bool burst_active;
+
+    /*
+     * Standby tier: after streaming stops the sensor is quiesced but stays
+     * powered, and the runtime PM reference is only dropped once
+     * standby_timeout_ms passes without a new stream. A restart from
+     * standby skips the regulators, XCLR and the register upload, but
+     * still waits the PWR_UP and stream floors before streaming.
+     */
+    u32 standby_timeout_ms;
+    bool standby_ref;
+    struct delayed_work standby_work;
 
-    bool streaming;
+
+    struct dentry *debugfs;
+    struct gmax4002_timing timing[GMAX4002_TIMING_NUM];
 };
 
 /* Helpers */
@@ -648,19 +1358,95 @@ static inline void get_mode_table(struct gmax4002 *gmax4002, unsigned int code,
     case MEDIA_BUS_FMT_SGRBG10_1X10:
     case MEDIA_BUS_FMT_SGBRG10_1X10:
     case MEDIA_BUS_FMT_SBGGR10_1X10:
+    case MEDIA_BUS_FMT_Y10_1X10:
         *mode_list = supported_modes_10bit;
         *num_modes = ARRAY_SIZE(supported_modes_10bit);
         break;
+    case MEDIA_BUS_FMT_SRGGB8_1X8:
+    case MEDIA_BUS_FMT_SGRBG8_1X8:
+    case MEDIA_BUS_FMT_SGBRG8_1X8:
+    case MEDIA_BUS_FMT_SBGGR8_1X8:
+    case MEDIA_BUS_FMT_Y8_1X8:
+        *mode_list = supported_modes_8bit;
+        *num_modes = ARRAY_SIZE(supported_modes_8bit);
+        break;
+    case MEDIA_BUS_FMT_SRGGB12_1X12:
+    case MEDIA_BUS_FMT_SGRBG12_1X12:
+    case MEDIA_BUS_FMT_SGBRG12_1X12:
+    case MEDIA_BUS_FMT_SBGGR12_1X12:
+    case MEDIA_BUS_FMT_Y12_1X12:
+        *mode_list = supported_modes_12bit;
+        *num_modes = ARRAY_SIZE(supported_modes_12bit);
+        break;
     default:
         *mode_list = NULL;
         *num_modes = 0;
     }
 }
 
+/*
+ * Mode behind a state. Scaled modes are told apart from a crop window of
+ * the same output size by their full-array crop, any other size is a crop
+ * window on the full resolution mode.
+ */
+static const struct gmax4002_mode *
+gmax4002_state_mode(struct gmax4002 *gmax4002,
+            const struct v4l2_mbus_framefmt *fmt,
+            const struct v4l2_rect *crop)
+{
+    const struct gmax4002_mode *mode_list, *mode;
+    unsigned int i, n_modes;
+
+    get_mode_table(gmax4002, fmt->code, &mode_list, &n_modes);
+    for (i = 0; i < n_modes; i++) {
+        mode = &mode_list[i];
+        if (mode->width == fmt->width && mode->height == fmt->height &&
+            (mode->vscale == 1 || crop->height == mode->crop.height))
+            return mode;
+    }
+
+    return &mode_list[0];
+}
+
+static unsigned int gmax4002_get_bpp(u32 code)
+{
+    switch (code) {
+    case MEDIA_BUS_FMT_SRGGB8_1X8:
+    case MEDIA_BUS_FMT_SGRBG8_1X8:
+    case MEDIA_BUS_FMT_SGBRG8_1X8:
+    case MEDIA_BUS_FMT_SBGGR8_1X8:
+    case MEDIA_BUS_FMT_Y8_1X8:
+        return 8;
+    case MEDIA_BUS_FMT_SRGGB12_1X12:
+    case MEDIA_BUS_FMT_SGRBG12_1X12:
+    case MEDIA_BUS_FMT_SGBRG12_1X12:
+    case MEDIA_BUS_FMT_SBGGR12_1X12:
+    case MEDIA_BUS_FMT_Y12_1X12:
+        return 12;
+    default:
+        return 10;
+    }
+}
+
+/* Pixels per second the CSI-2 link carries at the active bit depth */
+static u64 gmax4002_pixel_rate(struct gmax4002 *gmax4002)
+{
+    return div_u64((u64)gmax4002_link_freq_menu[gmax4002->link_freq_idx] *
+               2 * gmax4002->lane_cfg->num_lanes,
+               gmax4002->bpp);
+}
+
 static u32 gmax4002_get_format_code(struct gmax4002 *gmax4002, u32 code)
 {
     unsigned int i;
 
+    if (gmax4002->mono) {
+        for (i = 0; i < ARRAY_SIZE(mono_codes); i++)
+            if (mono_codes[i] == code)
+                return mono_codes[i];
+        return mono_codes[0];
+    }
+
     for (i = 0; i < ARRAY_SIZE(codes); i++)
         if (codes[i] == code)
             return codes[i];
@@ -668,108 +1454,1235 @@ static u32 gmax4002_get_format_code(struct gmax4002 *gmax4002, u32 code)
 }
 
 /* --------------------------------------------------------------------------
- * Controls
+ * Register tables
  * --------------------------------------------------------------------------
  */
 
-static int gmax4002_set_ctrl(struct v4l2_ctrl *ctrl)
+/*
+ * Fold a cci_reg_sequence into blocks of consecutive 8-bit registers. Wider
+ * registers are expanded to their byte layout so they join the run as well.
+ */
+static int gmax4002_compile_table(struct device *dev,
+                  const struct cci_reg_sequence *regs,
+                  unsigned int num_regs,
+                  struct gmax4002_reg_table *table)
 {
-    struct gmax4002 *gmax4002 = container_of(ctrl->handler, struct gmax4002, ctrl_handler);
-    const struct gmax4002_mode *mode, *mode_list;
-    struct v4l2_subdev_state *state;
-    struct v4l2_mbus_framefmt *fmt;
-    unsigned int num_modes;
-    int ret = 0;
-
-    /* Apply control only when powered (runtime active). */
-    if (!pm_runtime_get_if_active(gmax4002->dev))
-        return 0;
+    struct gmax4002_reg_block *blk = NULL;
+    unsigned int i, j, width, nbytes = 0;
+    u8 *data;
+
+    for (i = 0; i < num_regs; i++)
+        nbytes += CCI_REG_WIDTH_BYTES(regs[i].reg);
+
+    /* Worst case every byte opens its own block */
+    data = devm_kzalloc(dev, nbytes, GFP_KERNEL);
+    table->blocks = devm_kcalloc(dev, nbytes, sizeof(*table->blocks),
+                     GFP_KERNEL);
+    if (!data || !table->blocks)
+        return -ENOMEM;
 
-    /* Look, I told you this is a bare minimum driver with external exposure contorl
-     * The only control that works is analog gain, VFLIP, HFLIP.
-     */
-    switch (ctrl->id) {
-    case V4L2_CID_EXPOSURE: {
-        //dev_info(gmax4002->dev, "EXPOSURE=%u -> SHR=%u (VMAX=%u HMAX=%u)\n", ctrl->val, 0, 0, 0);
-    }
-    case V4L2_CID_ANALOGUE_GAIN:
-        dev_info(gmax4002->dev, "ANALOG_GAIN=%u\n", ctrl->val);
-        ret = cci_write(gmax4002->regmap, GMAX4002_REG_ANALOG_GAIN, ctrl->val, NULL);
-        if (ret)
-            dev_err_ratelimited(gmax4002->dev, "Gain write failed (%d)\n", ret);
-        break;
-    case V4L2_CID_VBLANK: {
-        //dev_info(gmax4002->dev, "VBLANK=%u -> VMAX=%u\n", ctrl->val, 0);
-        break;
-    }
-    case V4L2_CID_HBLANK: {
-        //dev_info(gmax4002->dev, "HBLANK=%u -> HMAX=%u\n", ctrl->val, 0);
-        break;
-    }
-    case V4L2_CID_VFLIP:
-        ret = cci_write(gmax4002->regmap, GMAX4002_REG_FLIP_V, ctrl->val, NULL);
-        break;
-    case V4L2_CID_HFLIP:
-        ret = cci_write(gmax4002->regmap, GMAX4002_REG_FLIP_H, ctrl->val, NULL);
-        break;
-    case V4L2_CID_BRIGHTNESS: {
-        //u16 blacklevel = min_t(u32, ctrl->val, 1023);
-        //ret = cci_write(gmax4002->regmap, GMAX4002_REG_BLKLEVEL, blacklevel, NULL);
-        break;
-    }
-    default:
-        dev_info(gmax4002->dev, "Unhandled ctrl %s: id=0x%x, val=0x%x\n",
-            ctrl->name, ctrl->id, ctrl->val);
-        break;
+    table->num_blocks = 0;
+    for (i = 0; i < num_regs; i++) {
+        u16 addr = CCI_REG_ADDR(regs[i].reg);
+
+        width = CCI_REG_WIDTH_BYTES(regs[i].reg);
+        if (!blk || blk->addr + blk->len != addr ||
+            blk->len + width > GMAX4002_BURST_MAX_LEN) {
+            blk = &table->blocks[table->num_blocks++];
+            blk->addr = addr;
+            blk->len = 0;
+            blk->data = data;
+        }
+
+        for (j = 0; j < width; j++) {
+            unsigned int shift = (regs[i].reg & CCI_REG_LE) ?
+                         j * 8 : (width - 1 - j) * 8;
+
+            *data++ = regs[i].val >> shift;
+        }
+        blk->len += width;
     }
 
-    pm_runtime_put(gmax4002->dev);
-    return ret;
+    return 0;
 }
 
-static const struct v4l2_ctrl_ops gmax4002_ctrl_ops = {
-    .s_ctrl = gmax4002_set_ctrl,
-};
-
-
-static int gmax4002_init_controls(struct gmax4002 *gmax4002)
+static int gmax4002_write_table(struct gmax4002 *gmax4002,
+                const struct gmax4002_reg_table *table)
 {
-    struct v4l2_ctrl_handler *hdl = &gmax4002->ctrl_handler;
-    struct v4l2_fwnode_device_properties props;
+    unsigned int i;
     int ret;
 
-    ret = v4l2_ctrl_handler_init(hdl, 16);
+    for (i = 0; i < table->num_blocks; i++) {
+        const struct gmax4002_reg_block *blk = &table->blocks[i];
 
-    /* Read-only, updated per mode */
-    gmax4002->pixel_rate = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
-                           V4L2_CID_PIXEL_RATE,
-                           1, GMAX4002_PIXEL_RATE, 1, 1);
-    gmax4002->link_freq =
-        v4l2_ctrl_new_int_menu(hdl, &gmax4002_ctrl_ops, V4L2_CID_LINK_FREQ,
-                       0, 0, gmax4002_link_freq_menu);
-    if (gmax4002->link_freq)
-        gmax4002->link_freq->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+        ret = regmap_bulk_write(gmax4002->regmap, blk->addr, blk->data,
+                    blk->len);
+        if (ret) {
+            dev_err(gmax4002->dev, "Burst write at 0x%04x (%u bytes) failed (%d)\n",
+                blk->addr, blk->len, ret);
+            return ret;
+        }
+    }
 
-    gmax4002->vblank = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
-                       V4L2_CID_VBLANK, 0, 0xFFFFF, 1, 0);
-    gmax4002->hblank = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
-                       V4L2_CID_HBLANK, 0, 0xFFFF, 1, 0);
+    return 0;
+}
 
-    gmax4002->exposure = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
-                         V4L2_CID_EXPOSURE,
-                         GMAX4002_EXPOSURE_MIN, GMAX4002_EXPOSURE_MAX,
-                         GMAX4002_EXPOSURE_STEP, GMAX4002_EXPOSURE_DEFAULT);
+static unsigned int gmax4002_mode_index(const struct gmax4002_mode *mode)
+{
+    unsigned int i, base = 0;
 
-    gmax4002->gain = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops, V4L2_CID_ANALOGUE_GAIN,
-                     GMAX4002_ANA_GAIN_MIN, GMAX4002_ANA_GAIN_MAX,
-                     GMAX4002_ANA_GAIN_STEP, GMAX4002_ANA_GAIN_DEFAULT);
+    for (i = 0; i < ARRAY_SIZE(gmax4002_mode_tables); i++) {
+        const struct gmax4002_mode *modes = gmax4002_mode_tables[i].modes;
+        unsigned int num_modes = gmax4002_mode_tables[i].num_modes;
 
-    gmax4002->vflip = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
-                      V4L2_CID_VFLIP, 0, 1, 1, 0);
+        if (mode >= modes && mode < modes + num_modes)
+            return base + (mode - modes);
+        base += num_modes;
+    }
 
-    gmax4002->hflip = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
-                      V4L2_CID_HFLIP, 0, 1, 1, 0);
-    if (hdl->error) {
+    return 0;
+}
+
+static const struct gmax4002_mode *gmax4002_mode_by_index(unsigned int index)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(gmax4002_mode_tables); i++) {
+        if (index < gmax4002_mode_tables[i].num_modes)
+            return &gmax4002_mode_tables[i].modes[index];
+        index -= gmax4002_mode_tables[i].num_modes;
+    }
+
+    return NULL;
+}
+
+static bool gmax4002_seq_reg_val(const struct cci_reg_sequence *regs,
+                 unsigned int num_regs, u32 reg, u64 *val)
+{
+    unsigned int i;
+
+    for (i = 0; i < num_regs; i++)
+        if (regs[i].reg == reg) {
+            *val = regs[i].val;
+            return true;
+        }
+
+    return false;
+}
+
+/*
+ * Value a mode leaves in a register: its own scale_list or reg_list entry,
+ * else the common table. False when none of them touches the register.
+ */
+static bool gmax4002_mode_reg_val(const struct gmax4002_mode *mode, u32 reg,
+                  u64 *val)
+{
+    return gmax4002_seq_reg_val(mode->scale_list.regs,
+                    mode->scale_list.num_of_regs, reg, val) ||
+           gmax4002_seq_reg_val(mode->reg_list.regs,
+                    mode->reg_list.num_of_regs, reg, val) ||
+           gmax4002_seq_reg_val(mode_common_regs,
+                    ARRAY_SIZE(mode_common_regs), reg, val);
+}
+
+/* Append the registers of regs whose value differs between from and to */
+static unsigned int gmax4002_diff_regs(const struct gmax4002_mode *from,
+                       const struct gmax4002_mode *to,
+                       const struct cci_reg_sequence *regs,
+                       unsigned int num_regs,
+                       struct cci_reg_sequence *delta,
+                       unsigned int num_delta)
+{
+    unsigned int i, j;
+    u64 from_val, to_val;
+
+    for (i = 0; i < num_regs; i++) {
+        u32 reg = regs[i].reg;
+
+        for (j = 0; j < num_delta; j++)
+            if (delta[j].reg == reg)
+                break;
+        if (j < num_delta)
+            continue;
+
+        if (!gmax4002_mode_reg_val(to, reg, &to_val) ||
+            (gmax4002_mode_reg_val(from, reg, &from_val) &&
+             from_val == to_val))
+            continue;
+
+        delta[num_delta].reg = reg;
+        delta[num_delta].val = to_val;
+        num_delta++;
+    }
+
+    return num_delta;
+}
+
+/*
+ * Precompute the writes between every pair of modes. Only registers a mode
+ * overrides can differ, so a switch, e.g. of the bit depth or binning,
+ * takes a few writes instead of the common table.
+ */
+static int gmax4002_compile_mode_deltas(struct gmax4002 *gmax4002)
+{
+    struct cci_reg_sequence *delta;
+    unsigned int from, to, n, max_regs = 0;
+    int ret = 0;
+
+    gmax4002->mode_deltas = devm_kcalloc(gmax4002->dev,
+                         GMAX4002_NUM_MODES * GMAX4002_NUM_MODES,
+                         sizeof(*gmax4002->mode_deltas),
+                         GFP_KERNEL);
+    if (!gmax4002->mode_deltas)
+        return -ENOMEM;
+
+    for (from = 0; from < GMAX4002_NUM_MODES; from++) {
+        const struct gmax4002_mode *mode = gmax4002_mode_by_index(from);
+
+        max_regs = max(max_regs, mode->reg_list.num_of_regs +
+                     mode->scale_list.num_of_regs);
+    }
+
+    delta = kcalloc(2 * max_regs, sizeof(*delta), GFP_KERNEL);
+    if (!delta)
+        return -ENOMEM;
+
+    for (from = 0; from < GMAX4002_NUM_MODES && !ret; from++) {
+        const struct gmax4002_mode *f = gmax4002_mode_by_index(from);
+
+        for (to = 0; to < GMAX4002_NUM_MODES && !ret; to++) {
+            const struct gmax4002_mode *t = gmax4002_mode_by_index(to);
+
+            n = gmax4002_diff_regs(f, t, f->reg_list.regs,
+                           f->reg_list.num_of_regs, delta, 0);
+            n = gmax4002_diff_regs(f, t, f->scale_list.regs,
+                           f->scale_list.num_of_regs, delta, n);
+            n = gmax4002_diff_regs(f, t, t->reg_list.regs,
+                           t->reg_list.num_of_regs, delta, n);
+            n = gmax4002_diff_regs(f, t, t->scale_list.regs,
+                           t->scale_list.num_of_regs, delta, n);
+
+            ret = gmax4002_compile_table(gmax4002->dev, delta, n,
+                             &gmax4002->mode_deltas[from * GMAX4002_NUM_MODES + to]);
+        }
+    }
+
+    kfree(delta);
+    return ret;
+}
+
+/*
+ * cci_write() for cached registers that skips the bus when the cache already
+ * holds the value, e.g. when the controls are re-applied on a restart.
+ */
+static int gmax4002_write(struct gmax4002 *gmax4002, u32 reg, u64 val, int *err)
+{
+    u64 cur;
+
+    if (err && *err)
+        return *err;
+
+    if (!cci_read(gmax4002->regmap, reg, &cur, NULL) && cur == val)
+        return 0;
+
+    return cci_write(gmax4002->regmap, reg, val, err);
+}
+
+/*
+ * Add a masked control write to the batch, called with pending_lock held.
+ * Later writes to the same register are merged into the earlier one. The
+ * bits outside the mask keep their value, e.g. from the vendor table.
+ */
+static int gmax4002_queue_update(struct gmax4002 *gmax4002, u32 reg, u64 mask,
+                 u64 val, int *err)
+{
+    struct gmax4002_pending_write *w;
+    unsigned int i;
+
+    if (err && *err)
+        return *err;
+
+    for (i = 0; i < gmax4002->num_pending; i++) {
+        w = &gmax4002->pending[i];
+        if (w->reg == reg) {
+            w->val = (w->val & ~mask) | (val & mask);
+            w->mask |= mask;
+            return 0;
+        }
+    }
+
+    if (WARN_ON_ONCE(gmax4002->num_pending == GMAX4002_MAX_PENDING)) {
+        if (err)
+            *err = -ENOSPC;
+        return -ENOSPC;
+    }
+
+    w = &gmax4002->pending[gmax4002->num_pending++];
+    w->reg = reg;
+    w->val = val & mask;
+    w->mask = mask;
+    return 0;
+}
+
+static int gmax4002_queue_write(struct gmax4002 *gmax4002, u32 reg, u64 val,
+                int *err)
+{
+    return gmax4002_queue_update(gmax4002, reg, U64_MAX, val, err);
+}
+
+/*
+ * Write the batched control registers inside one group hold, so they latch
+ * at the same frame start. Called with flush_lock held, which stream start
+ * and stop also hold so no batch lands in the middle of them. Needs neither
+ * the control lock nor a runtime PM reference, a batch of a sensor that
+ * powered off is dropped.
+ */
+static int __gmax4002_flush_ctrls(struct gmax4002 *gmax4002)
+{
+    struct gmax4002_pending_write batch[GMAX4002_MAX_PENDING];
+    unsigned int i, num;
+    u64 val;
+    int ret = 0, hold_ret;
+
+    lockdep_assert_held(&gmax4002->flush_lock);
+
+    spin_lock(&gmax4002->pending_lock);
+    num = gmax4002->num_pending;
+    memcpy(batch, gmax4002->pending, num * sizeof(*batch));
+    gmax4002->num_pending = 0;
+    spin_unlock(&gmax4002->pending_lock);
+
+    if (!num || pm_runtime_get_if_active(gmax4002->dev) <= 0)
+        return 0;
+
+    ret = cci_write(gmax4002->regmap, GMAX4002_REG_GRP_HOLD,
+            GMAX4002_GRP_HOLD_EN, NULL);
+    if (!ret) {
+        for (i = 0; i < num && !ret; i++) {
+            val = batch[i].val;
+            /* Cached, so the other bits come without a bus read */
+            if (batch[i].mask != U64_MAX) {
+                ret = cci_read(gmax4002->regmap, batch[i].reg, &val, NULL);
+                val = (val & ~batch[i].mask) | batch[i].val;
+            }
+            gmax4002_write(gmax4002, batch[i].reg, val, &ret);
+        }
+
+        /* Release the hold even after a failed write */
+        hold_ret = cci_write(gmax4002->regmap, GMAX4002_REG_GRP_HOLD, 0,
+                     NULL);
+        if (!ret)
+            ret = hold_ret;
+    }
+    if (ret) {
+        dev_err_ratelimited(gmax4002->dev, "Control write failed (%d)\n", ret);
+        /*
+         * The cache took the new values before the bus failed, so it no
+         * longer matches the sensor: forget them and have the next stream
+         * start upload everything again.
+         */
+        for (i = 0; i < num; i++)
+            regcache_drop_region(gmax4002->regmap,
+                         CCI_REG_ADDR(batch[i].reg),
+                         CCI_REG_ADDR(batch[i].reg) +
+                         CCI_REG_WIDTH_BYTES(batch[i].reg) - 1);
+        gmax4002->flush_failed = true;
+    }
+
+    pm_runtime_put(gmax4002->dev);
+    return ret;
+}
+
+static void gmax4002_flush_work(struct work_struct *work)
+{
+    struct gmax4002 *gmax4002 = container_of(work, struct gmax4002,
+                         flush_work);
+
+    mutex_lock(&gmax4002->flush_lock);
+    __gmax4002_flush_ctrls(gmax4002);
+    mutex_unlock(&gmax4002->flush_lock);
+}
+
+/* Status and handshake registers, always read from the sensor */
+static bool gmax4002_volatile_reg(struct device *dev, unsigned int reg)
+{
+    return reg == CCI_REG_ADDR(GMAX4002_REG_CTRL0) ||
+           reg == CCI_REG_ADDR(GMAX4002_REG_PWR_UP) ||
+           reg == CCI_REG_ADDR(GMAX4002_REG_ANALOG_SEQ0) ||
+           reg == CCI_REG_ADDR(GMAX4002_REG_ANALOG_SEQ1) ||
+           (reg >= CCI_REG_ADDR(GMAX4002_REG_FRAME_COUNT) &&
+        reg < CCI_REG_ADDR(GMAX4002_REG_FRAME_COUNT) +
+              CCI_REG_WIDTH_BYTES(GMAX4002_REG_FRAME_COUNT));
+}
+
+static const struct regmap_config gmax4002_regmap_config = {
+    .reg_bits = 16,
+    .val_bits = 8,
+    .max_register = GMAX4002_REG_MAX,
+    .volatile_reg = gmax4002_volatile_reg,
+    .cache_type = REGCACHE_MAPLE,
+};
+
+/* --------------------------------------------------------------------------
+ * Frame accounting
+ * --------------------------------------------------------------------------
+ */
+
+/* Fold the sensor frame counter into frames, control lock held */
+static int gmax4002_update_frames(struct gmax4002 *gmax4002)
+{
+    u64 val;
+    int ret;
+
+    /* Powered down, nothing was read out since the last update */
+    if (!pm_runtime_get_if_active(gmax4002->dev))
+        return 0;
+
+    ret = cci_read(gmax4002->regmap, GMAX4002_REG_FRAME_COUNT, &val, NULL);
+    pm_runtime_put(gmax4002->dev);
+    if (ret)
+        return ret;
+
+    gmax4002->frames += (u16)(val - gmax4002->frame_count_last);
+    gmax4002->frame_count_last = val;
+    return 0;
+}
+
+/* Restart the counts, called right before STREAM_EN */
+static int gmax4002_reset_frames(struct gmax4002 *gmax4002)
+{
+    u64 val;
+    int ret;
+
+    ret = cci_read(gmax4002->regmap, GMAX4002_REG_FRAME_COUNT, &val, NULL);
+    if (ret)
+        return ret;
+
+    gmax4002->frame_count_last = val;
+    gmax4002->frames = 0;
+    atomic_set(&gmax4002->triggers, 0);
+    WRITE_ONCE(gmax4002->trigger_last, 0);
+    WRITE_ONCE(gmax4002->trigger_period_ns, 0);
+    return 0;
+}
+
+static irqreturn_t gmax4002_trigger_irq(int irq, void *data)
+{
+    struct gmax4002 *gmax4002 = data;
+    struct v4l2_event ev = {
+        .type = V4L2_EVENT_FRAME_SYNC,
+    };
+    ktime_t now = ktime_get();
+
+    if (gmax4002->trigger_last)
+        WRITE_ONCE(gmax4002->trigger_period_ns,
+               ktime_to_ns(ktime_sub(now, gmax4002->trigger_last)));
+    WRITE_ONCE(gmax4002->trigger_last, now);
+
+    ev.u.frame_sync.frame_sequence = atomic_inc_return(&gmax4002->triggers) - 1;
+    if (gmax4002->sd.devnode)
+        v4l2_event_queue(gmax4002->sd.devnode, &ev);
+
+    /* A late work item still sees every trigger, not just the last one */
+    if (READ_ONCE(gmax4002->burst_active)) {
+        atomic_inc(&gmax4002->burst_due);
+        queue_work(system_highpri_wq, &gmax4002->burst_work);
+    }
+
+    return IRQ_HANDLED;
+}
+
+static int gmax4002_frames_get(void *data, u64 *val)
+{
+    struct gmax4002 *gmax4002 = data;
+    int ret;
+
+    mutex_lock(gmax4002->ctrl_handler.lock);
+    ret = gmax4002_update_frames(gmax4002);
+    *val = gmax4002->frames;
+    mutex_unlock(gmax4002->ctrl_handler.lock);
+
+    return ret;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(gmax4002_frames_fops, gmax4002_frames_get, NULL, "%llu\n");
+
+static int gmax4002_frame_count_get(void *data, u64 *val)
+{
+    struct gmax4002 *gmax4002 = data;
+    int ret;
+
+    mutex_lock(gmax4002->ctrl_handler.lock);
+    ret = gmax4002_update_frames(gmax4002);
+    *val = gmax4002->frame_count_last;
+    mutex_unlock(gmax4002->ctrl_handler.lock);
+
+    return ret;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(gmax4002_frame_count_fops, gmax4002_frame_count_get,
+             NULL, "%llu\n");
+
+/* --------------------------------------------------------------------------
+ * Readiness
+ * --------------------------------------------------------------------------
+ */
+
+static const char *gmax4002_timing_name(unsigned int phase)
+{
+    return phase < GMAX4002_READY_NUM ? gmax4002_ready_cfgs[phase].name :
+                        gmax4002_timing_names[phase];
+}
+
+/* Account the time since start to a phase, returns it in us */
+static u32 gmax4002_timing_record(struct gmax4002 *gmax4002,
+                  unsigned int phase, ktime_t start)
+{
+    struct gmax4002_timing *t = &gmax4002->timing[phase];
+    u32 us = ktime_us_delta(ktime_get(), start);
+    unsigned long flags;
+
+    spin_lock_irqsave(&t->lock, flags);
+    t->last_us = us;
+    if (!t->count || us < t->min_us)
+        t->min_us = us;
+    t->max_us = max(t->max_us, us);
+    t->count++;
+    t->hist[min(fls(us), GMAX4002_TIMING_BUCKETS - 1)]++;
+    spin_unlock_irqrestore(&t->lock, flags);
+
+    return us;
+}
+
+/* Plain regmap_read(), cci_read() would log every expected NAK */
+static int gmax4002_ready_read(struct gmax4002 *gmax4002, u32 reg)
+{
+    unsigned int val;
+
+    return regmap_read(gmax4002->regmap, CCI_REG_ADDR(reg), &val);
+}
+
+static int gmax4002_wait_ready(struct gmax4002 *gmax4002,
+                   enum gmax4002_ready_phase phase)
+{
+    const struct gmax4002_ready_cfg *cfg = &gmax4002_ready_cfgs[phase];
+    ktime_t start = ktime_get();
+    int ret = 0, err;
+
+    fsleep(cfg->floor_us);
+
+    if (cfg->reg) {
+        ret = read_poll_timeout(gmax4002_ready_read, err, !err,
+                    GMAX4002_READY_POLL_US, cfg->timeout_us,
+                    false, gmax4002, cfg->reg);
+        if (ret)
+            dev_err(gmax4002->dev, "%s not ready after %u us\n",
+                cfg->name, cfg->floor_us + cfg->timeout_us);
+    }
+
+    trace_gmax4002_ready(gmax4002->dev, cfg->name,
+                 gmax4002_timing_record(gmax4002, phase, start), ret);
+    return ret;
+}
+
+static void gmax4002_debugfs_init(struct gmax4002 *gmax4002)
+{
+    struct dentry *dir;
+    char name[32];
+    unsigned int i;
+
+    snprintf(name, sizeof(name), "gmax4002-%s", dev_name(gmax4002->dev));
+    gmax4002->debugfs = debugfs_create_dir(name, NULL);
+
+    dir = debugfs_create_dir("time_to_ready_us", gmax4002->debugfs);
+    for (i = 0; i < GMAX4002_READY_NUM; i++)
+        debugfs_create_u32(gmax4002_ready_cfgs[i].name, 0444, dir,
+                   &gmax4002->timing[i].last_us);
+
+    dir = debugfs_create_dir("frames", gmax4002->debugfs);
+    debugfs_create_file_unsafe("sensor_frame_count", 0444, dir, gmax4002,
+                   &gmax4002_frame_count_fops);
+    debugfs_create_file_unsafe("frames", 0444, dir, gmax4002,
+                   &gmax4002_frames_fops);
+    debugfs_create_atomic_t("triggers", 0444, dir, &gmax4002->triggers);
+}
+
+/* --------------------------------------------------------------------------
+ * Controls
+ * --------------------------------------------------------------------------
+ */
+
+/* Precompute the analogue gain split so set_ctrl is a table lookup */
+static int gmax4002_init_gain_lut(struct gmax4002 *gmax4002)
+{
+    unsigned int n = GMAX4002_ANA_GAIN_MAX - GMAX4002_ANA_GAIN_MIN + 1;
+    unsigned int i, code = 0;
+
+    gmax4002->gain_lut = devm_kcalloc(gmax4002->dev, n,
+                      sizeof(*gmax4002->gain_lut), GFP_KERNEL);
+    if (!gmax4002->gain_lut)
+        return -ENOMEM;
+
+    for (i = 0; i < n; i++) {
+        u32 gain = GMAX4002_ANA_GAIN_MIN + i;
+
+        while (code + 1 < ARRAY_SIZE(gmax4002_again_steps) &&
+               gmax4002_again_steps[code + 1] <= gain)
+            code++;
+
+        gmax4002->gain_lut[i].code = code;
+        gmax4002->gain_lut[i].residual =
+            DIV_ROUND_CLOSEST(gain * GMAX4002_GAIN_UNITY,
+                      gmax4002_again_steps[code]);
+    }
+
+    return 0;
+}
+
+static bool gmax4002_internal_timing(struct gmax4002 *gmax4002)
+{
+    return gmax4002->sync_mode != GMAX4002_SYNC_EXT_EXPOSURE;
+}
+
+static void gmax4002_update_exposure_range(struct gmax4002 *gmax4002, u32 vblank)
+{
+    u32 exposure_max;
+
+    if (!gmax4002_internal_timing(gmax4002))
+        return;
+
+    exposure_max = gmax4002->frame_height + vblank - GMAX4002_INT_EXPOSURE_OFFSET;
+    __v4l2_ctrl_modify_range(gmax4002->exposure, GMAX4002_INT_EXPOSURE_MIN,
+                 exposure_max, 1,
+                 min_t(u32, GMAX4002_INT_EXPOSURE_DEFAULT, exposure_max));
+}
+
+/*
+ * Refresh the pixel rate, blanking and exposure limits for the output
+ * format and sync mode.
+ */
+/* Both gains of a row share the link, so dual gain doubles the line time */
+static u32 gmax4002_line_length(struct gmax4002 *gmax4002)
+{
+    return gmax4002->hdr->val == GMAX4002_HDR_DUAL_GAIN ?
+           2 * GMAX4002_LINE_LENGTH : GMAX4002_LINE_LENGTH;
+}
+
+static void gmax4002_update_timing_ranges(struct gmax4002 *gmax4002)
+{
+    u32 hblank = gmax4002_line_length(gmax4002) - gmax4002->frame_width;
+    u64 pixel_rate = gmax4002_pixel_rate(gmax4002);
+
+    __v4l2_ctrl_modify_range(gmax4002->pixel_rate, pixel_rate, pixel_rate,
+                 1, pixel_rate);
+    __v4l2_ctrl_modify_range(gmax4002->hblank, hblank, hblank, 1, hblank);
+
+    if (!gmax4002_internal_timing(gmax4002)) {
+        /* Frame timing comes from the trigger pulse, report placeholders */
+        __v4l2_ctrl_modify_range(gmax4002->vblank, 0, GMAX4002_VBLANK_MAX, 1, 0);
+        __v4l2_ctrl_modify_range(gmax4002->exposure,
+                     GMAX4002_EXPOSURE_MIN, GMAX4002_EXPOSURE_MAX,
+                     GMAX4002_EXPOSURE_STEP, GMAX4002_EXPOSURE_DEFAULT);
+        return;
+    }
+
+    __v4l2_ctrl_modify_range(gmax4002->vblank, GMAX4002_VBLANK_MIN,
+                 GMAX4002_FRAME_LENGTH_MAX - gmax4002->frame_height, 1,
+                 GMAX4002_FRAME_LENGTH_DEFAULT - gmax4002->frame_height);
+    gmax4002_update_exposure_range(gmax4002, gmax4002->vblank->val);
+}
+
+/* Split an analogue gain into PGA code and digital residual and queue both */
+static int gmax4002_queue_gain(struct gmax4002 *gmax4002, u32 again, u32 dgain,
+                   int *err)
+{
+    const struct gmax4002_gain_step *step =
+        &gmax4002->gain_lut[again - GMAX4002_ANA_GAIN_MIN];
+
+    /* The residual may push the top of the digital range past the field */
+    dgain = min_t(u32, (dgain * step->residual + GMAX4002_GAIN_UNITY / 2) /
+              GMAX4002_GAIN_UNITY, GMAX4002_DGTL_GAIN_MAX);
+
+    gmax4002_queue_write(gmax4002, GMAX4002_REG_ANALOG_GAIN, step->code, err);
+    return gmax4002_queue_write(gmax4002, GMAX4002_REG_DIGITAL_GAIN, dgain, err);
+}
+
+/* Let the window top follow a new crop, its height stays fixed meanwhile */
+static void gmax4002_update_roi_ctrl(struct gmax4002 *gmax4002,
+                     const struct v4l2_rect *crop)
+{
+    __v4l2_ctrl_modify_range(gmax4002->roi_top, GMAX4002_PIXEL_ARRAY_TOP,
+                 GMAX4002_PIXEL_ARRAY_TOP +
+                 GMAX4002_PIXEL_ARRAY_HEIGHT - crop->height,
+                 GMAX4002_ROI_Y_ALIGN, crop->top);
+    __v4l2_ctrl_s_ctrl(gmax4002->roi_top, crop->top);
+}
+
+static int gmax4002_set_ctrl(struct v4l2_ctrl *ctrl)
+{
+    struct gmax4002 *gmax4002 = container_of(ctrl->handler, struct gmax4002, ctrl_handler);
+    bool dual;
+    int ret = 0;
+
+    /* Limits follow the timing controls even while powered down */
+    switch (ctrl->id) {
+    case V4L2_CID_GMAX4002_SYNC_MODE:
+        gmax4002->sync_mode = ctrl->val;
+        gmax4002_update_timing_ranges(gmax4002);
+        break;
+    case V4L2_CID_VBLANK:
+        gmax4002_update_exposure_range(gmax4002, ctrl->val);
+        break;
+    case V4L2_CID_LINK_FREQ:
+        /* A new PLL setting is programmed by the next full configure */
+        if (ctrl->val != gmax4002->link_freq_idx) {
+            gmax4002->link_freq_idx = ctrl->val;
+            gmax4002->configured = false;
+            gmax4002_update_timing_ranges(gmax4002);
+        }
+        break;
+    case V4L2_CID_HDR_SENSOR_MODE:
+        gmax4002_update_timing_ranges(gmax4002);
+        break;
+    case V4L2_CID_GMAX4002_BURST_ARM:
+        /* While streaming the burst starts with the next trigger */
+        gmax4002->burst_pos = 0;
+        atomic_set(&gmax4002->burst_due, 0);
+        if (v4l2_subdev_is_streaming(&gmax4002->sd))
+            WRITE_ONCE(gmax4002->burst_active, true);
+        else
+            gmax4002->burst_armed = true;
+        return 0;
+    case V4L2_CID_GMAX4002_ROI_TOP:
+        /* Moves the active crop, the state lock is the control lock */
+        if (gmax4002->sd.active_state)
+            v4l2_subdev_state_get_crop(gmax4002->sd.active_state,
+                           GMAX4002_PAD_IMAGE)->top = ctrl->val;
+        break;
+    }
+
+    /*
+     * Apply control only when powered (runtime active). The writes are only
+     * queued here, the flush work sends them outside the control lock.
+     * A cluster is queued in one go and the group hold of the flush makes
+     * the sensor latch it at one frame start, so exposure and gain always
+     * change together. Separate clusters of one S_EXT_CTRLS, e.g. VBLANK,
+     * the flips and the gain, may be flushed apart and latch in different
+     * frames.
+     */
+    if (!pm_runtime_active(gmax4002->dev))
+        return 0;
+
+    spin_lock(&gmax4002->pending_lock);
+
+    /*
+     * In external exposure mode the trigger pulse sets exposure and frame
+     * rate, so EXPOSURE/VBLANK are only written in the internal modes.
+     */
+    switch (ctrl->id) {
+    case V4L2_CID_GMAX4002_SYNC_MODE:
+        ret = gmax4002_queue_write(gmax4002, GMAX4002_REG_SYNC_MODE,
+                       gmax4002_sync_mode_regval[ctrl->val],
+                       NULL);
+        break;
+    case V4L2_CID_EXPOSURE:
+        /* Cluster master, also carries the analogue and digital gain */
+        if (gmax4002->exposure->is_new && gmax4002_internal_timing(gmax4002))
+            ret = gmax4002_queue_write(gmax4002, GMAX4002_REG_EXPOSURE,
+                           gmax4002->exposure->val, NULL);
+        if (!ret && (gmax4002->gain->is_new || gmax4002->dgain->is_new)) {
+            gmax4002_queue_gain(gmax4002, gmax4002->gain->val,
+                        gmax4002->dgain->val, &ret);
+            trace_gmax4002_ctrl(gmax4002->dev, gmax4002->gain->id,
+                        gmax4002->gain->val, ret);
+            trace_gmax4002_ctrl(gmax4002->dev, gmax4002->dgain->id,
+                        gmax4002->dgain->val, ret);
+        }
+        break;
+    case V4L2_CID_VBLANK:
+        if (gmax4002_internal_timing(gmax4002))
+            ret = gmax4002_queue_write(gmax4002, GMAX4002_REG_FRAME_LENGTH,
+                           gmax4002->frame_height + ctrl->val,
+                           NULL);
+        break;
+    case V4L2_CID_HBLANK:
+        /* Read-only, fixed by the line length */
+        break;
+    case V4L2_CID_LINK_FREQ:
+        /* Written at configure time, see above */
+        break;
+    case V4L2_CID_VFLIP:
+        ret = gmax4002_queue_write(gmax4002, GMAX4002_REG_FLIP_V,
+                       ctrl->val, NULL);
+        break;
+    case V4L2_CID_HFLIP:
+        ret = gmax4002_queue_write(gmax4002, GMAX4002_REG_FLIP_H,
+                       ctrl->val, NULL);
+        break;
+    case V4L2_CID_BRIGHTNESS:
+        ret = gmax4002_queue_write(gmax4002, GMAX4002_REG_BLKLEVEL,
+                       ctrl->val, NULL);
+        break;
+    case V4L2_CID_GMAX4002_TRIGGER_DELAY:
+        ret = gmax4002_queue_write(gmax4002, GMAX4002_REG_TRIG_DELAY,
+                       ctrl->val, NULL);
+        break;
+    case V4L2_CID_HDR_SENSOR_MODE:
+        /* Off is the table state, no bus access unless HDR ran before */
+        dual = ctrl->val == GMAX4002_HDR_DUAL_GAIN;
+        gmax4002_queue_write(gmax4002, GMAX4002_REG_DUAL_GAIN_VC,
+                     dual ? GMAX4002_HDR_VC : GMAX4002_DUAL_GAIN_VC_OFF,
+                     &ret);
+        gmax4002_queue_update(gmax4002, GMAX4002_REG_DUAL_GAIN,
+                      GMAX4002_DUAL_GAIN_EN,
+                      dual ? GMAX4002_DUAL_GAIN_EN : 0, &ret);
+        break;
+    case V4L2_CID_GMAX4002_BURST_GAINS:
+    case V4L2_CID_GMAX4002_BURST_EXPOSURES:
+        /* Written a step at a time by the sequencer */
+        break;
+    case V4L2_CID_GMAX4002_PULSE_WIDTH:
+        /* Only feeds Max Trigger Rate */
+        break;
+    case V4L2_CID_GMAX4002_OVERLAP:
+        ret = gmax4002_queue_update(gmax4002, GMAX4002_REG_READOUT_MODE,
+                        GMAX4002_READOUT_OVERLAP,
+                        ctrl->val ? GMAX4002_READOUT_OVERLAP : 0,
+                        NULL);
+        break;
+    case V4L2_CID_TEST_PATTERN:
+        ret = gmax4002_queue_update(gmax4002, GMAX4002_REG_TEST_PATTERN,
+                        GMAX4002_TEST_PATTERN_SEL,
+                        ctrl->val ?
+                        FIELD_PREP(GMAX4002_TEST_PATTERN_SEL, ctrl->val) :
+                        GMAX4002_TEST_PATTERN_OFF, NULL);
+        break;
+    case V4L2_CID_GMAX4002_ROI_TOP:
+        /* Latched with the group hold, the window moves at a frame start */
+        ret = gmax4002_queue_write(gmax4002, GMAX4002_REG_ROI_Y_START,
+                       ctrl->val, NULL);
+        break;
+    default:
+        dev_dbg(gmax4002->dev, "Unhandled ctrl %s: id=0x%x, val=0x%x\n",
+            ctrl->name, ctrl->id, ctrl->val);
+        break;
+    }
+
+    spin_unlock(&gmax4002->pending_lock);
+
+    /* The gains of the cluster were traced above */
+    if (ctrl->is_new)
+        trace_gmax4002_ctrl(gmax4002->dev, ctrl->id, ctrl->val, ret);
+
+    /* Probe may still unwind, stream start flushes the batch anyway */
+    if (!ret && READ_ONCE(gmax4002->probed))
+        queue_work(system_highpri_wq, &gmax4002->flush_work);
+
+    return ret;
+}
+
+/* Highest frame rate in mHz the readout of the active mode allows */
+static u32 gmax4002_max_readout_mhz(struct gmax4002 *gmax4002)
+{
+    return div_u64(gmax4002_pixel_rate(gmax4002) * 1000,
+               gmax4002_line_length(gmax4002) * gmax4002->frame_height);
+}
+
+/*
+ * Highest trigger rate in mHz: readout plus exposure, or the longer of the
+ * two with overlapped readout. The pulse sets the exposure in external
+ * exposure mode, the driver cannot see it and takes the width it was told.
+ */
+static u32 gmax4002_max_trigger_mhz(struct gmax4002 *gmax4002)
+{
+    u32 lines = gmax4002->frame_height;
+    u32 exposure;
+
+    if (gmax4002->sync_mode == GMAX4002_SYNC_EXT_EXPOSURE)
+        exposure = gmax4002->pulse_width->val;
+    else
+        exposure = gmax4002->exposure->val;
+
+    if (gmax4002->overlap->val)
+        lines = max(lines, exposure);
+    else
+        lines += exposure;
+
+    return div_u64(gmax4002_pixel_rate(gmax4002) * 1000,
+               (u64)gmax4002_line_length(gmax4002) * lines);
+}
+
+/*
+ * Current frame rate in mHz: from the frame length with internal timing,
+ * else from the trigger interval, 0 while unknown.
+ */
+static u32 gmax4002_readout_mhz(struct gmax4002 *gmax4002)
+{
+    u64 period_ns;
+
+    if (gmax4002_internal_timing(gmax4002))
+        return div64_u64(gmax4002_pixel_rate(gmax4002) * 1000,
+                 (u64)gmax4002_line_length(gmax4002) *
+                 (gmax4002->frame_height + gmax4002->vblank->val));
+
+    period_ns = READ_ONCE(gmax4002->trigger_period_ns);
+    if (!period_ns)
+        return 0;
+
+    /* Once the triggers stop, the rate decays with the time since the last */
+    period_ns = max_t(u64, period_ns,
+              ktime_to_ns(ktime_sub(ktime_get(),
+                        READ_ONCE(gmax4002->trigger_last))));
+
+    return min_t(u64, div64_u64(NSEC_PER_SEC * 1000ULL, period_ns),
+             GMAX4002_RATE_MAX);
+}
+
+/* Image payload at the current frame rate over the link capacity, percent */
+static u32 gmax4002_lane_util(struct gmax4002 *gmax4002)
+{
+    u64 link_bps = (u64)gmax4002_link_freq_menu[gmax4002->link_freq_idx] *
+               2 * gmax4002->lane_cfg->num_lanes;
+    u64 payload = (u64)gmax4002->frame_width * gmax4002->frame_height *
+              gmax4002->bpp * gmax4002_readout_mhz(gmax4002);
+
+    if (gmax4002->hdr->val == GMAX4002_HDR_DUAL_GAIN)
+        payload *= 2;
+
+    return min_t(u64, div64_u64(payload / 10, link_bps),
+             GMAX4002_LANE_UTIL_MAX);
+}
+
+static int gmax4002_get_volatile_ctrl(struct v4l2_ctrl *ctrl)
+{
+    struct gmax4002 *gmax4002 = container_of(ctrl->handler, struct gmax4002, ctrl_handler);
+    int ret = 0;
+
+    switch (ctrl->id) {
+    case V4L2_CID_GMAX4002_FRAME_COUNT:
+        ret = gmax4002_update_frames(gmax4002);
+        ctrl->val = gmax4002->frame_count_last;
+        break;
+    case V4L2_CID_GMAX4002_TRIGGERS:
+        ctrl->val64 = (u32)atomic_read(&gmax4002->triggers);
+        break;
+    case V4L2_CID_GMAX4002_FRAMES:
+        ret = gmax4002_update_frames(gmax4002);
+        ctrl->val64 = gmax4002->frames;
+        break;
+    case V4L2_CID_GMAX4002_READOUT_RATE:
+        ctrl->val = gmax4002_readout_mhz(gmax4002);
+        break;
+    case V4L2_CID_GMAX4002_MAX_READOUT_RATE:
+        ctrl->val = gmax4002_max_readout_mhz(gmax4002);
+        break;
+    case V4L2_CID_GMAX4002_LANE_UTIL:
+        ctrl->val = gmax4002_lane_util(gmax4002);
+        break;
+    case V4L2_CID_GMAX4002_MAX_TRIGGER_RATE:
+        ctrl->val = gmax4002_max_trigger_mhz(gmax4002);
+        break;
+    case V4L2_CID_GMAX4002_PEDESTAL: {
+        u64 val = gmax4002->blklevel->val;
+
+        /* The programmed value when powered, the control otherwise */
+        if (pm_runtime_get_if_active(gmax4002->dev)) {
+            ret = cci_read(gmax4002->regmap, GMAX4002_REG_BLKLEVEL, &val, NULL);
+            pm_runtime_put(gmax4002->dev);
+        }
+
+        /* Scaled to the codes of the active output format */
+        if (gmax4002->bpp >= GMAX4002_BLKLEVEL_BPP)
+            ctrl->val = val << (gmax4002->bpp - GMAX4002_BLKLEVEL_BPP);
+        else
+            ctrl->val = val >> (GMAX4002_BLKLEVEL_BPP - gmax4002->bpp);
+        break;
+    }
+    default:
+        ret = -EINVAL;
+        break;
+    }
+
+    return ret;
+}
+
+static const struct v4l2_ctrl_ops gmax4002_ctrl_ops = {
+    .g_volatile_ctrl = gmax4002_get_volatile_ctrl,
+    .s_ctrl = gmax4002_set_ctrl,
+};
+
+static const struct v4l2_ctrl_config gmax4002_ctrl_sync_mode = {
+    .ops  = &gmax4002_ctrl_ops,
+    .id   = V4L2_CID_GMAX4002_SYNC_MODE,
+    .name = "Sync Mode",
+    .type = V4L2_CTRL_TYPE_MENU,
+    .max  = ARRAY_SIZE(gmax4002_sync_mode_menu) - 1,
+    .qmenu = gmax4002_sync_mode_menu,
+};
+
+static const struct v4l2_ctrl_config gmax4002_ctrl_frame_count = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_FRAME_COUNT,
+    .name  = "Sensor Frame Count",
+    .type  = V4L2_CTRL_TYPE_INTEGER,
+    .flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+    .max   = GMAX4002_FRAME_COUNT_MAX,
+    .step  = 1,
+};
+
+static const struct v4l2_ctrl_config gmax4002_ctrl_triggers = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_TRIGGERS,
+    .name  = "Triggers Seen",
+    .type  = V4L2_CTRL_TYPE_INTEGER64,
+    .flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+    .max   = U32_MAX,
+    .step  = 1,
+};
+
+static const struct v4l2_ctrl_config gmax4002_ctrl_trigger_delay = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_TRIGGER_DELAY,
+    .name  = "Trigger Delay",
+    .type  = V4L2_CTRL_TYPE_INTEGER,
+    .max   = GMAX4002_TRIG_DELAY_MAX,
+    .step  = 1,
+};
+
+/* Per-frame analogue gain of a burst, same units as V4L2_CID_ANALOGUE_GAIN */
+static const struct v4l2_ctrl_config gmax4002_ctrl_burst_gains = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_BURST_GAINS,
+    .name  = "Burst Gains",
+    .type  = V4L2_CTRL_TYPE_U32,
+    .flags = V4L2_CTRL_FLAG_DYNAMIC_ARRAY,
+    .min   = GMAX4002_ANA_GAIN_MIN,
+    .max   = GMAX4002_ANA_GAIN_MAX,
+    .def   = GMAX4002_ANA_GAIN_DEFAULT,
+    .step  = GMAX4002_ANA_GAIN_STEP,
+    .dims  = { GMAX4002_BURST_MAX_STEPS },
+};
+
+/* Per-frame exposure in lines, only used in the internally timed modes */
+static const struct v4l2_ctrl_config gmax4002_ctrl_burst_exposures = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_BURST_EXPOSURES,
+    .name  = "Burst Exposures",
+    .type  = V4L2_CTRL_TYPE_U32,
+    .flags = V4L2_CTRL_FLAG_DYNAMIC_ARRAY,
+    .min   = GMAX4002_INT_EXPOSURE_MIN,
+    .max   = GMAX4002_FRAME_LENGTH_MAX - GMAX4002_INT_EXPOSURE_OFFSET,
+    .def   = GMAX4002_INT_EXPOSURE_DEFAULT,
+    .step  = 1,
+    .dims  = { GMAX4002_BURST_MAX_STEPS },
+};
+
+static const struct v4l2_ctrl_config gmax4002_ctrl_burst_arm = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_BURST_ARM,
+    .name  = "Burst Arm",
+    .type  = V4L2_CTRL_TYPE_BUTTON,
+};
+
+/* Readout window top row, movable while streaming, range set from the crop */
+static const struct v4l2_ctrl_config gmax4002_ctrl_roi_top = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_ROI_TOP,
+    .name  = "ROI Top",
+    .type  = V4L2_CTRL_TYPE_INTEGER,
+    .min   = GMAX4002_PIXEL_ARRAY_TOP,
+    .max   = GMAX4002_PIXEL_ARRAY_TOP,
+    .def   = GMAX4002_PIXEL_ARRAY_TOP,
+    .step  = GMAX4002_ROI_Y_ALIGN,
+};
+
+static const struct v4l2_ctrl_config gmax4002_ctrl_pedestal = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_PEDESTAL,
+    .name  = "Black Level Pedestal",
+    .type  = V4L2_CTRL_TYPE_INTEGER,
+    .flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+    .max   = GMAX4002_BLKLEVEL_MAX << (12 - GMAX4002_BLKLEVEL_BPP),
+    .step  = 1,
+};
+
+static const struct v4l2_ctrl_config gmax4002_ctrl_frames = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_FRAMES,
+    .name  = "Frames Emitted",
+    .type  = V4L2_CTRL_TYPE_INTEGER64,
+    .flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+    .max   = U32_MAX,
+    .step  = 1,
+};
+
+static const struct v4l2_ctrl_config gmax4002_ctrl_readout_rate = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_READOUT_RATE,
+    .name  = "Readout Rate (mHz)",
+    .type  = V4L2_CTRL_TYPE_INTEGER,
+    .flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+    .max   = GMAX4002_RATE_MAX,
+    .step  = 1,
+};
+
+static const struct v4l2_ctrl_config gmax4002_ctrl_max_readout_rate = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_MAX_READOUT_RATE,
+    .name  = "Max Readout Rate (mHz)",
+    .type  = V4L2_CTRL_TYPE_INTEGER,
+    .flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+    .max   = GMAX4002_RATE_MAX,
+    .step  = 1,
+};
+
+static const struct v4l2_ctrl_config gmax4002_ctrl_overlap = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_OVERLAP,
+    .name  = "Overlapped Readout",
+    .type  = V4L2_CTRL_TYPE_BOOLEAN,
+    .max   = 1,
+    .step  = 1,
+};
+
+/* Trigger pulse width of the external exposure mode, only for the rate */
+static const struct v4l2_ctrl_config gmax4002_ctrl_pulse_width = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_PULSE_WIDTH,
+    .name  = "Trigger Pulse Width (lines)",
+    .type  = V4L2_CTRL_TYPE_INTEGER,
+    .max   = GMAX4002_FRAME_LENGTH_MAX,
+    .step  = 1,
+};
+
+static const struct v4l2_ctrl_config gmax4002_ctrl_max_trigger_rate = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_MAX_TRIGGER_RATE,
+    .name  = "Max Trigger Rate (mHz)",
+    .type  = V4L2_CTRL_TYPE_INTEGER,
+    .flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+    .max   = GMAX4002_RATE_MAX,
+    .step  = 1,
+};
+
+static const struct v4l2_ctrl_config gmax4002_ctrl_lane_util = {
+    .ops   = &gmax4002_ctrl_ops,
+    .id    = V4L2_CID_GMAX4002_LANE_UTIL,
+    .name  = "Lane Utilization (%)",
+    .type  = V4L2_CTRL_TYPE_INTEGER,
+    .flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+    .max   = GMAX4002_LANE_UTIL_MAX,
+    .step  = 1,
+};
+
+
+static int gmax4002_init_controls(struct gmax4002 *gmax4002)
+{
+    struct v4l2_ctrl_handler *hdl = &gmax4002->ctrl_handler;
+    struct v4l2_fwnode_device_properties props;
+    struct v4l2_ctrl_config sync_cfg = gmax4002_ctrl_sync_mode;
+    struct v4l2_ctrl_config delay_cfg = gmax4002_ctrl_trigger_delay;
+    int ret;
+
+    ret = v4l2_ctrl_handler_init(hdl, 16);
+
+    /* First, so the sync mode is programmed before the timing controls */
+    sync_cfg.def = gmax4002->sync_mode;
+    /* In an array the role fixes the sync mode */
+    if (gmax4002->sync_role != GMAX4002_SYNC_ROLE_NONE)
+        sync_cfg.flags |= V4L2_CTRL_FLAG_READ_ONLY;
+    gmax4002->sync_ctrl = v4l2_ctrl_new_custom(hdl, &sync_cfg, NULL);
+
+    /* Read-only, updated per mode */
+    gmax4002->pixel_rate = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
+                           V4L2_CID_PIXEL_RATE,
+                           1, S64_MAX, 1,
+                           gmax4002_pixel_rate(gmax4002));
+    gmax4002->link_freq =
+        v4l2_ctrl_new_int_menu(hdl, &gmax4002_ctrl_ops, V4L2_CID_LINK_FREQ,
+                       ARRAY_SIZE(gmax4002_link_freq_menu) - 1,
+                       gmax4002->link_freq_idx,
+                       gmax4002_link_freq_menu);
+    /* Only offer the frequencies the board lists in link-frequencies */
+    if (gmax4002->link_freq)
+        gmax4002->link_freq->menu_skip_mask = ~gmax4002->link_freq_bitmap;
+
+    gmax4002->vblank = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
+                       V4L2_CID_VBLANK, 0, GMAX4002_VBLANK_MAX, 1, 0);
+    gmax4002->hblank = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
+                       V4L2_CID_HBLANK, 0, 0xFFFF, 1, 0);
+    if (gmax4002->hblank)
+        gmax4002->hblank->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+
+    gmax4002->exposure = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
+                         V4L2_CID_EXPOSURE,
+                         GMAX4002_EXPOSURE_MIN, GMAX4002_EXPOSURE_MAX,
+                         GMAX4002_EXPOSURE_STEP, GMAX4002_EXPOSURE_DEFAULT);
+
+    gmax4002->gain = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops, V4L2_CID_ANALOGUE_GAIN,
+                     GMAX4002_ANA_GAIN_MIN, GMAX4002_ANA_GAIN_MAX,
+                     GMAX4002_ANA_GAIN_STEP, GMAX4002_ANA_GAIN_DEFAULT);
+
+    gmax4002->dgain = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops, V4L2_CID_DIGITAL_GAIN,
+                      GMAX4002_DGTL_GAIN_MIN, GMAX4002_DGTL_GAIN_MAX,
+                      GMAX4002_DGTL_GAIN_STEP, GMAX4002_DGTL_GAIN_DEFAULT);
+
+    /* Exposure and gains are applied together */
+    v4l2_ctrl_cluster(3, &gmax4002->exposure);
+
+    gmax4002->vflip = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
+                      V4L2_CID_VFLIP, 0, 1, 1, 0);
+
+    gmax4002->hflip = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
+                      V4L2_CID_HFLIP, 0, 1, 1, 0);
+
+    /* Skew compensation in lines, from gpixel,trigger-delay-lines */
+    delay_cfg.def = gmax4002->trigger_delay;
+    v4l2_ctrl_new_custom(hdl, &delay_cfg, NULL);
+
+    gmax4002->roi_top = v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_roi_top, NULL);
+
+    /* The sequencer steps on the trigger interrupt */
+    if (gmax4002->trigger_gpio) {
+        gmax4002->burst_gains =
+            v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_burst_gains, NULL);
+        gmax4002->burst_exposures =
+            v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_burst_exposures, NULL);
+        v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_burst_arm, NULL);
+    }
+
+    v4l2_ctrl_new_std_menu_items(hdl, &gmax4002_ctrl_ops, V4L2_CID_TEST_PATTERN,
+                     ARRAY_SIZE(gmax4002_test_pattern_menu) - 1,
+                     0, 0, gmax4002_test_pattern_menu);
+
+    /* The low gain image goes out on pad GMAX4002_PAD_HDR */
+    gmax4002->hdr = v4l2_ctrl_new_std_menu_items(hdl, &gmax4002_ctrl_ops,
+                             V4L2_CID_HDR_SENSOR_MODE,
+                             ARRAY_SIZE(gmax4002_hdr_menu) - 1,
+                             0, GMAX4002_HDR_OFF,
+                             gmax4002_hdr_menu);
+
+    /* Black level offset, the pedestal reports it in output codes */
+    gmax4002->blklevel = v4l2_ctrl_new_std(hdl, &gmax4002_ctrl_ops,
+                           V4L2_CID_BRIGHTNESS, 0,
+                           GMAX4002_BLKLEVEL_MAX, 1,
+                           GMAX4002_BLKLEVEL_DEFAULT);
+    v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_pedestal, NULL);
+
+    /* Counts since the last stream start, triggers need trigger-gpios */
+    v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_frame_count, NULL);
+    v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_triggers, NULL);
+    v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_frames, NULL);
+
+    /* Link load, the trigger rate is only measured with trigger-gpios */
+    v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_readout_rate, NULL);
+    v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_max_readout_rate, NULL);
+    v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_lane_util, NULL);
+
+    /* Exposure of the next frame during readout of the current one */
+    gmax4002->overlap = v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_overlap, NULL);
+    gmax4002->pulse_width = v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_pulse_width,
+                             NULL);
+    v4l2_ctrl_new_custom(hdl, &gmax4002_ctrl_max_trigger_rate, NULL);
+    if (hdl->error) {
         ret = hdl->error;
         dev_err(gmax4002->dev, "control init failed (%d)\n", ret);
         goto err_free;
@@ -783,6 +2696,10 @@ static int gmax4002_init_controls(struct gmax4002 *gmax4002)
     if (ret)
         goto err_free;
 
+    mutex_lock(hdl->lock);
+    gmax4002_update_timing_ranges(gmax4002);
+    mutex_unlock(hdl->lock);
+
     gmax4002->sd.ctrl_handler = hdl;
     return 0;
 
@@ -796,6 +2713,83 @@ static void gmax4002_free_controls(struct gmax4002 *gmax4002)
     v4l2_ctrl_handler_free(gmax4002->sd.ctrl_handler);
 }
 
+/* --------------------------------------------------------------------------
+ * Burst sequencer
+ * --------------------------------------------------------------------------
+ */
+
+/*
+ * Queue the next step of the burst, called with the state lock held and
+ * written by the next flush. Steps whose trigger was merged into a later
+ * one are skipped, so every step still lands in its own frame. Once the
+ * burst is over the gain and exposure controls are back in effect.
+ */
+static void gmax4002_burst_step(struct gmax4002 *gmax4002, unsigned int missed)
+{
+    const struct v4l2_ctrl *gains = gmax4002->burst_gains;
+    const struct v4l2_ctrl *exposures = gmax4002->burst_exposures;
+    unsigned int pos;
+    int ret = 0;
+
+    if (!gmax4002->burst_active)
+        return;
+
+    if (missed) {
+        dev_warn_ratelimited(gmax4002->dev,
+                     "Burst step %u late, %u steps skipped\n",
+                     gmax4002->burst_pos, missed);
+        gmax4002->burst_pos += missed;
+    }
+    pos = gmax4002->burst_pos;
+
+    spin_lock(&gmax4002->pending_lock);
+    if (pos >= gains->elems) {
+        WRITE_ONCE(gmax4002->burst_active, false);
+        gmax4002_queue_gain(gmax4002, gmax4002->gain->val,
+                    gmax4002->dgain->val, &ret);
+        if (gmax4002_internal_timing(gmax4002))
+            gmax4002_queue_write(gmax4002, GMAX4002_REG_EXPOSURE,
+                         gmax4002->exposure->val, &ret);
+    } else {
+        gmax4002_queue_gain(gmax4002, gains->p_cur.p_u32[pos],
+                    gmax4002->dgain->val, &ret);
+        if (pos < exposures->elems && gmax4002_internal_timing(gmax4002))
+            gmax4002_queue_write(gmax4002, GMAX4002_REG_EXPOSURE,
+                         clamp_t(u32, exposures->p_cur.p_u32[pos],
+                             gmax4002->exposure->minimum,
+                             gmax4002->exposure->maximum),
+                         &ret);
+    }
+    spin_unlock(&gmax4002->pending_lock);
+
+    trace_gmax4002_ctrl(gmax4002->dev, V4L2_CID_GMAX4002_BURST_GAINS, pos,
+                ret);
+    if (ret)
+        dev_err_ratelimited(gmax4002->dev, "Burst step %u failed (%d)\n",
+                    pos, ret);
+
+    gmax4002->burst_pos++;
+}
+
+static void gmax4002_burst_work(struct work_struct *work)
+{
+    struct gmax4002 *gmax4002 = container_of(work, struct gmax4002,
+                         burst_work);
+    struct v4l2_subdev_state *state;
+
+    unsigned int due;
+
+    state = v4l2_subdev_lock_and_get_active_state(&gmax4002->sd);
+    /* Each trigger since the last run is one step */
+    due = atomic_xchg(&gmax4002->burst_due, 0);
+    if (due)
+        gmax4002_burst_step(gmax4002, due - 1);
+    v4l2_subdev_unlock_state(state);
+
+    /* flush_work is fenced by stream start and stop */
+    queue_work(system_highpri_wq, &gmax4002->flush_work);
+}
+
 /* --------------------------------------------------------------------------
  * Pad ops / formats
  * --------------------------------------------------------------------------
@@ -806,16 +2800,40 @@ static int gmax4002_enum_mbus_code(struct v4l2_subdev *sd,
                  struct v4l2_subdev_mbus_code_enum *code)
 {
     struct gmax4002 *gmax4002 = to_gmax4002(sd);
-    unsigned int entries;
+    unsigned int entries, stride;
     const u32 *tbl;
 
-    tbl = codes;
-    entries = ARRAY_SIZE(codes) / 4;
+    if (code->pad == GMAX4002_PAD_METADATA) {
+        if (code->index)
+            return -EINVAL;
+        code->code = MEDIA_BUS_FMT_SENSOR_DATA;
+        return 0;
+    }
+
+    /* The low gain image always has the format of the image pad */
+    if (code->pad == GMAX4002_PAD_HDR) {
+        if (code->index)
+            return -EINVAL;
+        code->code = v4l2_subdev_state_get_format(sd_state,
+                              GMAX4002_PAD_IMAGE)->code;
+        return 0;
+    }
+
+    /* codes[] holds four Bayer orders per depth, only the first is native */
+    if (gmax4002->mono) {
+        tbl = mono_codes;
+        stride = 1;
+        entries = ARRAY_SIZE(mono_codes);
+    } else {
+        tbl = codes;
+        stride = 4;
+        entries = ARRAY_SIZE(codes) / 4;
+    }
 
     if (code->index >= entries)
         return -EINVAL;
 
-    code->code = gmax4002_get_format_code(gmax4002, tbl[code->index * 4]);
+    code->code = gmax4002_get_format_code(gmax4002, tbl[code->index * stride]);
     return 0;
 }
 
@@ -827,6 +2845,29 @@ static int gmax4002_enum_frame_size(struct v4l2_subdev *sd,
     const struct gmax4002_mode *mode_list;
     unsigned int num_modes;
 
+    if (fse->pad == GMAX4002_PAD_METADATA) {
+        if (fse->index || fse->code != MEDIA_BUS_FMT_SENSOR_DATA)
+            return -EINVAL;
+        fse->min_width  = GMAX4002_EMBEDDED_LINE_WIDTH;
+        fse->max_width  = fse->min_width;
+        fse->min_height = GMAX4002_NUM_EMBEDDED_LINES;
+        fse->max_height = fse->min_height;
+        return 0;
+    }
+
+    if (fse->pad == GMAX4002_PAD_HDR) {
+        const struct v4l2_mbus_framefmt *fmt =
+            v4l2_subdev_state_get_format(sd_state, GMAX4002_PAD_IMAGE);
+
+        if (fse->index || fse->code != fmt->code)
+            return -EINVAL;
+        fse->min_width  = fmt->width;
+        fse->max_width  = fse->min_width;
+        fse->min_height = fmt->height;
+        fse->max_height = fse->min_height;
+        return 0;
+    }
+
     get_mode_table(gmax4002, fse->code, &mode_list, &num_modes);
     if (fse->index >= num_modes)
         return -EINVAL;
@@ -841,115 +2882,696 @@ static int gmax4002_enum_frame_size(struct v4l2_subdev *sd,
     return 0;
 }
 
-static int gmax4002_set_pad_format(struct v4l2_subdev *sd,
-                 struct v4l2_subdev_state *sd_state,
-                 struct v4l2_subdev_format *fmt)
+static int gmax4002_set_pad_format(struct v4l2_subdev *sd,
+                 struct v4l2_subdev_state *sd_state,
+                 struct v4l2_subdev_format *fmt)
+{
+    struct gmax4002 *gmax4002 = to_gmax4002(sd);
+    const struct gmax4002_mode *mode_list, *mode;
+    unsigned int num_modes;
+    struct v4l2_mbus_framefmt *format;
+    struct v4l2_rect *crop;
+
+    /* The embedded line has a fixed layout */
+    if (fmt->pad == GMAX4002_PAD_METADATA) {
+        fmt->format.code   = MEDIA_BUS_FMT_SENSOR_DATA;
+        fmt->format.width  = GMAX4002_EMBEDDED_LINE_WIDTH;
+        fmt->format.height = GMAX4002_NUM_EMBEDDED_LINES;
+        fmt->format.field  = V4L2_FIELD_NONE;
+        fmt->format.colorspace = V4L2_COLORSPACE_RAW;
+        *v4l2_subdev_state_get_format(sd_state, GMAX4002_PAD_METADATA) =
+            fmt->format;
+        return 0;
+    }
+
+    /* Follows the image pad, set through it */
+    if (fmt->pad == GMAX4002_PAD_HDR) {
+        fmt->format = *v4l2_subdev_state_get_format(sd_state,
+                                GMAX4002_PAD_IMAGE);
+        return 0;
+    }
+
+    /* Normalize requested code to what we really support */
+    fmt->format.code = gmax4002_get_format_code(gmax4002, fmt->format.code);
+
+    get_mode_table(gmax4002, fmt->format.code, &mode_list, &num_modes);
+    mode = v4l2_find_nearest_size(mode_list, num_modes, width, height,
+                                  fmt->format.width, fmt->format.height);
+
+    fmt->format.width        = mode->width;
+    fmt->format.height       = mode->height;
+    fmt->format.field        = V4L2_FIELD_NONE;
+    fmt->format.colorspace   = V4L2_COLORSPACE_RAW;
+    fmt->format.ycbcr_enc    = V4L2_YCBCR_ENC_601;
+    fmt->format.quantization = V4L2_QUANTIZATION_FULL_RANGE;
+    fmt->format.xfer_func    = V4L2_XFER_FUNC_NONE;
+
+    /* Update TRY/ACTIVE format kept by the framework */
+    format = v4l2_subdev_state_get_format(sd_state, GMAX4002_PAD_IMAGE);
+    *format = fmt->format;
+    *v4l2_subdev_state_get_format(sd_state, GMAX4002_PAD_HDR) = fmt->format;
+
+    /* Keep the crop in sync with the selected mode */
+    crop = v4l2_subdev_state_get_crop(sd_state, GMAX4002_PAD_IMAGE);
+    *crop = mode->crop;
+
+    if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE) {
+        gmax4002->bpp = gmax4002_get_bpp(fmt->format.code);
+        gmax4002->frame_width = mode->width;
+        gmax4002->frame_height = mode->height;
+        gmax4002_update_timing_ranges(gmax4002);
+        gmax4002_update_roi_ctrl(gmax4002, crop);
+    }
+
+    return 0;
+}
+
+
+
+/* --------------------------------------------------------------------------
+ * Array sync
+ * --------------------------------------------------------------------------
+ */
+
+static LIST_HEAD(gmax4002_sync_list);
+static DEFINE_MUTEX(gmax4002_sync_lock);
+
+/* gmax4002_sync_lock held */
+static bool gmax4002_sync_slaves_armed(u32 group)
+{
+    struct gmax4002 *other;
+
+    list_for_each_entry(other, &gmax4002_sync_list, sync_node)
+        if (other->sync_group == group &&
+            other->sync_role == GMAX4002_SYNC_ROLE_SLAVE &&
+            !other->sync_armed)
+            return false;
+
+    return true;
+}
+
+/*
+ * Mark a sensor (un)armed and let the master of its group re-evaluate. The
+ * master's registers are only touched from its own work, under its lock.
+ */
+static void gmax4002_sync_arm(struct gmax4002 *gmax4002, bool armed)
+{
+    struct gmax4002 *other;
+
+    if (gmax4002->sync_role == GMAX4002_SYNC_ROLE_NONE)
+        return;
+
+    mutex_lock(&gmax4002_sync_lock);
+    gmax4002->sync_armed = armed;
+    list_for_each_entry(other, &gmax4002_sync_list, sync_node)
+        if (other->sync_group == gmax4002->sync_group &&
+            other->sync_role == GMAX4002_SYNC_ROLE_MASTER &&
+            other->sync_armed)
+            schedule_work(&other->sync_work);
+    mutex_unlock(&gmax4002_sync_lock);
+}
+
+/*
+ * Master only: start streaming with XVS once the whole group is waiting for
+ * it, and stop XVS while a slave is missing. The master keeps free-running
+ * without XVS until the slave is armed again.
+ */
+static void gmax4002_sync_work(struct work_struct *work)
+{
+    struct gmax4002 *gmax4002 = container_of(work, struct gmax4002, sync_work);
+    struct v4l2_subdev_state *state;
+    bool want;
+    int ret = 0;
+
+    state = v4l2_subdev_lock_and_get_active_state(&gmax4002->sd);
+    mutex_lock(&gmax4002->flush_lock);
+
+    mutex_lock(&gmax4002_sync_lock);
+    want = gmax4002->sync_armed &&
+           gmax4002_sync_slaves_armed(gmax4002->sync_group);
+    mutex_unlock(&gmax4002_sync_lock);
+
+    if (want && !gmax4002->sync_out) {
+        /* XVS first, so the first frame already drives the slaves */
+        cci_write(gmax4002->regmap, GMAX4002_REG_SYNC_OUT,
+              GMAX4002_SYNC_OUT_EN, &ret);
+        //STREAM_EN = 1
+        cci_update_bits(gmax4002->regmap, GMAX4002_REG_CTRL0,
+                GMAX4002_STREAM_EN, GMAX4002_STREAM_EN, &ret);
+        if (ret)
+            dev_err(gmax4002->dev, "Failed to start the sync output\n");
+        else
+            gmax4002->sync_out = true;
+    } else if (!want && gmax4002->sync_out && gmax4002->sync_armed) {
+        cci_write(gmax4002->regmap, GMAX4002_REG_SYNC_OUT, 0, &ret);
+        if (ret)
+            dev_err(gmax4002->dev, "Failed to stop the sync output\n");
+        else
+            gmax4002->sync_out = false;
+    }
+
+    mutex_unlock(&gmax4002->flush_lock);
+    v4l2_subdev_unlock_state(state);
+}
+
+static void gmax4002_sync_register(struct gmax4002 *gmax4002)
+{
+    if (gmax4002->sync_role == GMAX4002_SYNC_ROLE_NONE)
+        return;
+
+    mutex_lock(&gmax4002_sync_lock);
+    list_add_tail(&gmax4002->sync_node, &gmax4002_sync_list);
+    mutex_unlock(&gmax4002_sync_lock);
+}
+
+static void gmax4002_sync_unregister(struct gmax4002 *gmax4002)
+{
+    if (gmax4002->sync_role == GMAX4002_SYNC_ROLE_NONE)
+        return;
+
+    mutex_lock(&gmax4002_sync_lock);
+    list_del(&gmax4002->sync_node);
+    mutex_unlock(&gmax4002_sync_lock);
+    cancel_work_sync(&gmax4002->sync_work);
+}
+
+/* --------------------------------------------------------------------------
+ * Stream on/off
+ * --------------------------------------------------------------------------
+ */
+
+/* Write only the registers that differ between the programmed mode and mode */
+static const struct gmax4002_reg_table *
+gmax4002_mode_delta(struct gmax4002 *gmax4002, const struct gmax4002_mode *from,
+            const struct gmax4002_mode *mode)
+{
+    return &gmax4002->mode_deltas[gmax4002_mode_index(from) * GMAX4002_NUM_MODES +
+                      gmax4002_mode_index(mode)];
+}
+
+/*
+ * Whether a delta only touches the readout scaling, which sits in the
+ * frame control block next to the ROI window that is already moved while
+ * powered. Anything else, e.g. the bit depth, is only changed with the
+ * analog side down.
+ */
+static bool gmax4002_delta_is_live(const struct gmax4002_reg_table *delta)
+{
+    unsigned int i, addr;
+
+    for (i = 0; i < delta->num_blocks; i++) {
+        const struct gmax4002_reg_block *blk = &delta->blocks[i];
+
+        for (addr = blk->addr; addr < blk->addr + blk->len; addr++)
+            if (addr != CCI_REG_ADDR(GMAX4002_REG_SKIP_V) &&
+                addr != CCI_REG_ADDR(GMAX4002_REG_BINNING))
+                return false;
+    }
+
+    return true;
+}
+
+static int gmax4002_switch_mode(struct gmax4002 *gmax4002,
+                const struct gmax4002_mode *from,
+                const struct gmax4002_mode *mode)
+{
+    int ret;
+
+    ret = gmax4002_write_table(gmax4002,
+                   gmax4002_mode_delta(gmax4002, from, mode));
+    if (ret)
+        dev_err(gmax4002->dev, "Failed to switch mode settings\n");
+
+    return ret;
+}
+
+/* The handshake registers are volatile and not synced, restore their start */
+static int gmax4002_restore_handshake(struct gmax4002 *gmax4002)
+{
+    static const u32 regs[] = {
+        GMAX4002_REG_ANALOG_SEQ0,
+        GMAX4002_REG_ANALOG_SEQ1,
+    };
+    unsigned int i;
+    int ret = 0;
+    u64 val;
+
+    for (i = 0; i < ARRAY_SIZE(regs); i++)
+        if (gmax4002_seq_reg_val(mode_common_regs,
+                     ARRAY_SIZE(mode_common_regs), regs[i], &val))
+            cci_write(gmax4002->regmap, regs[i], val, &ret);
+
+    return ret;
+}
+
+/*
+ * Bring the register file to mode and enable the sensor clock. Only needed
+ * after a power cycle or when the selected mode differs from the programmed
+ * one. The common table is only uploaded while the register file is
+ * unknown, i.e. after probe or a failed write.
+ */
+static int gmax4002_configure(struct gmax4002 *gmax4002,
+                  const struct gmax4002_mode *mode)
+{
+    const struct gmax4002_mode *from = gmax4002->programmed_mode;
+    ktime_t start = ktime_get();
+    int ret;
+
+    /* Known again once the upload completed */
+    gmax4002->programmed_mode = NULL;
+
+    /*
+     * Clock and lanes are set up already: a scaling-only delta is applied
+     * with the analog side kept as it is.
+     */
+    if (gmax4002->configured && from &&
+        gmax4002_delta_is_live(gmax4002_mode_delta(gmax4002, from, mode))) {
+        ret = gmax4002_switch_mode(gmax4002, from, mode);
+        if (ret) {
+            gmax4002->configured = false;
+            return ret;
+        }
+        gmax4002->programmed_mode = mode;
+        gmax4002_timing_record(gmax4002, GMAX4002_TIMING_UPLOAD, start);
+        return 0;
+    }
+
+    /*
+     * Other deltas go in as after a power cycle: analog side down, the
+     * handshake registers reset and the clock settled again, PWR_UP and
+     * the handshake follow at stream start. This also covers a powered
+     * sensor whose configured flag a link frequency change cleared, the
+     * PLL must not be reprogrammed with the analog side up.
+     */
+    if (from && !gmax4002->cache_dirty) {
+        //PWR_UP_EN = 0, CLK_STABLE_EN = 0
+        ret = cci_write(gmax4002->regmap, GMAX4002_REG_PWR_UP, 0, NULL);
+        cci_update_bits(gmax4002->regmap, GMAX4002_REG_CTRL0,
+                GMAX4002_CLK_STABLE_EN, 0, &ret);
+        if (!ret)
+            ret = gmax4002_restore_handshake(gmax4002);
+        if (ret) {
+            gmax4002->configured = false;
+            return ret;
+        }
+    }
+
+    /* The table clears PWR_UP_EN, so the analog side is down afterwards */
+    gmax4002->configured = false;
+    gmax4002->analog_on = false;
+
+    /*
+     * After a power cycle the cache replays the last upload, leaving the
+     * sensor as in standby: CTRL0 and PWR_UP are volatile and stay at
+     * their reset values, the handshake registers are put back to their
+     * table values. Without a known image a full upload follows, so the
+     * cache is only dropped instead of sent twice.
+     */
+    if (gmax4002->cache_dirty) {
+        if (from) {
+            ret = regcache_sync(gmax4002->regmap);
+            if (!ret)
+                ret = gmax4002_restore_handshake(gmax4002);
+            if (ret) {
+                dev_err(gmax4002->dev, "Failed to restore registers (%d)\n", ret);
+                return ret;
+            }
+        } else {
+            regcache_drop_region(gmax4002->regmap, 0, GMAX4002_REG_MAX);
+        }
+        gmax4002->cache_dirty = false;
+    }
+
+    if (from) {
+        /* The sensor holds the image of from, restored or still powered */
+        ret = gmax4002_switch_mode(gmax4002, from, mode);
+        if (ret)
+            return ret;
+    } else {
+        ret = gmax4002_write_table(gmax4002, &gmax4002->common_table);
+        if (ret) {
+            dev_err(gmax4002->dev, "Failed to write common settings\n");
+            return ret;
+        }
+
+        ret = cci_multi_reg_write(gmax4002->regmap, mode->reg_list.regs,
+                      mode->reg_list.num_of_regs, NULL);
+        if (ret) {
+            dev_err(gmax4002->dev, "Failed to write mode settings\n");
+            return ret;
+        }
+
+        ret = cci_multi_reg_write(gmax4002->regmap, mode->scale_list.regs,
+                      mode->scale_list.num_of_regs, NULL);
+        if (ret) {
+            dev_err(gmax4002->dev, "Failed to write scaling settings\n");
+            return ret;
+        }
+    }
+
+    ret = cci_multi_reg_write(gmax4002->regmap,
+                  gmax4002->lane_cfg->reg_list.regs,
+                  gmax4002->lane_cfg->reg_list.num_of_regs, NULL);
+    if (ret) {
+        dev_err(gmax4002->dev, "Failed to write lane settings\n");
+        return ret;
+    }
+
+    ret = cci_write(gmax4002->regmap, GMAX4002_REG_PLL_MULT,
+            gmax4002_pll_mult[gmax4002->link_freq_idx], NULL);
+    if (ret) {
+        dev_err(gmax4002->dev, "Failed to write PLL settings\n");
+        return ret;
+    }
+    gmax4002_timing_record(gmax4002, GMAX4002_TIMING_UPLOAD, start);
+
+    ret = gmax4002_wait_ready(gmax4002, GMAX4002_READY_CLK);
+    if (ret)
+        return ret;
+
+    //CLK_STABLE_EN = 1
+    ret = cci_update_bits(gmax4002->regmap, GMAX4002_REG_CTRL0,
+                  GMAX4002_CLK_STABLE_EN, GMAX4002_CLK_STABLE_EN, NULL);
+    if (ret)
+        return ret;
+
+    gmax4002->configured = true;
+    gmax4002->programmed_mode = mode;
+    return 0;
+}
+
+/* Power up the analog side, required after configure or standby */
+static int gmax4002_power_up_analog(struct gmax4002 *gmax4002)
+{
+    ktime_t start;
+    int ret;
+
+    //PWR_UP_EN = 1
+    ret = cci_write(gmax4002->regmap, GMAX4002_REG_PWR_UP, GMAX4002_PWR_UP_EN, NULL);
+    if (!ret)
+        ret = gmax4002_wait_ready(gmax4002, GMAX4002_READY_PWR_UP);
+
+    start = ktime_get();
+    /* D<0x3024>_Bit<5>=0 */
+    cci_update_bits(gmax4002->regmap, CCI_REG8(0x3024), BIT(5), 0, &ret);
+    /* D<0x3023>_Bit<7:4>=b'1111 */
+    cci_update_bits(gmax4002->regmap, CCI_REG8(0x3023), GENMASK(7, 4),FIELD_PREP(GENMASK(7, 4), 0xF), &ret);
+    /* D<0x3023>_Bit<0>=1 */
+    cci_update_bits(gmax4002->regmap, CCI_REG8(0x3023), BIT(0), BIT(0), &ret);
+    /* D<0x3023>_Bit<2:1>=2'b11 */
+    cci_update_bits(gmax4002->regmap, CCI_REG8(0x3023), GENMASK(2, 1),FIELD_PREP(GENMASK(2, 1), 0x3), &ret);
+    /* D<0x3024>_Bit<5>=1 */
+    cci_update_bits(gmax4002->regmap, CCI_REG8(0x3024), BIT(5), BIT(5), &ret);
+    /* D<0x3023>_Bit<2>=0 */
+    cci_update_bits(gmax4002->regmap, CCI_REG8(0x3023), BIT(2), 0, &ret);
+    if (ret) {
+        dev_err(gmax4002->dev, "Power-up sequence failed\n");
+        return ret;
+    }
+    gmax4002_timing_record(gmax4002, GMAX4002_TIMING_ANALOG_SEQ, start);
+
+    gmax4002->analog_on = true;
+    return 0;
+}
+
+/* One frame at the current timing, in us */
+static u32 gmax4002_frame_period_us(struct gmax4002 *gmax4002)
 {
-    struct gmax4002 *gmax4002 = to_gmax4002(sd);
-    const struct gmax4002_mode *mode_list, *mode;
-    unsigned int num_modes;
-    struct v4l2_mbus_framefmt *format;
-    struct v4l2_rect *crop;
+    u64 lines = gmax4002->frame_height;
 
-    /* Normalize requested code to what we really support */
-    fmt->format.code = gmax4002_get_format_code(gmax4002, fmt->format.code);
+    /* VBLANK is a placeholder with external exposure, only readout counts */
+    if (gmax4002_internal_timing(gmax4002))
+        lines += gmax4002->vblank->val;
+    else
+        lines += GMAX4002_VBLANK_MIN;
 
-    get_mode_table(gmax4002, fmt->format.code, &mode_list, &num_modes);
-    mode = v4l2_find_nearest_size(mode_list, num_modes, width, height,
-                                  fmt->format.width, fmt->format.height);
+    return max_t(u32, GMAX4002_STOP_MIN_PERIOD_US,
+             div_u64(lines * gmax4002_line_length(gmax4002) * USEC_PER_SEC,
+                 gmax4002_pixel_rate(gmax4002)));
+}
 
-    fmt->format.width        = mode->width;
-    fmt->format.height       = mode->height;
-    fmt->format.field        = V4L2_FIELD_NONE;
-    fmt->format.colorspace   = V4L2_COLORSPACE_RAW;
-    fmt->format.ycbcr_enc    = V4L2_YCBCR_ENC_601;
-    fmt->format.quantization = V4L2_QUANTIZATION_FULL_RANGE;
-    fmt->format.xfer_func    = V4L2_XFER_FUNC_NONE;
+/*
+ * Clear STREAM_EN and wait for the frame in flight to end, so the lanes are
+ * idle and the register file can be reused for a fast restart. A failed
+ * write makes the next stream start from a full upload.
+ */
+static int gmax4002_stop_streaming(struct gmax4002 *gmax4002)
+{
+    u32 period_us = gmax4002_frame_period_us(gmax4002);
+    ktime_t start = ktime_get();
+    ktime_t still = start, now;
+    u64 count, last;
+    s64 elapsed;
+    int ret;
 
-    /* Update TRY/ACTIVE format kept by the framework */
-    format = v4l2_subdev_state_get_format(sd_state, 0);
-    *format = fmt->format;
+    //STREAM_EN = 0
+    ret = cci_update_bits(gmax4002->regmap, GMAX4002_REG_CTRL0,
+                  GMAX4002_STREAM_EN, 0, NULL);
+    cci_read(gmax4002->regmap, GMAX4002_REG_FRAME_COUNT, &last, &ret);
+    if (ret) {
+        gmax4002->configured = false;
+        gmax4002->programmed_mode = NULL;
+        return ret;
+    }
 
-    /* Keep the crop in sync with the selected mode */
-    crop = v4l2_subdev_state_get_crop(sd_state, 0);
-    *crop = mode->crop;
+    /* No single sleep may run past the cap, it holds the state lock */
+    for (;;) {
+        elapsed = ktime_us_delta(ktime_get(), start);
+        if (elapsed >= GMAX4002_STOP_TIMEOUT_US) {
+            dev_dbg(gmax4002->dev, "Frame end not seen after %u us\n",
+                GMAX4002_STOP_TIMEOUT_US);
+            break;
+        }
+
+        fsleep(min3(period_us, (u32)GMAX4002_STOP_POLL_US,
+                (u32)(GMAX4002_STOP_TIMEOUT_US - elapsed)));
+        ret = cci_read(gmax4002->regmap, GMAX4002_REG_FRAME_COUNT, &count,
+                   NULL);
+        if (ret) {
+            gmax4002->configured = false;
+            gmax4002->programmed_mode = NULL;
+            break;
+        }
+
+        now = ktime_get();
+        if (count != last) {
+            last = count;
+            still = now;
+        } else if (ktime_us_delta(now, still) >= period_us) {
+            break;
+        }
+    }
 
-    return 0;
+    trace_gmax4002_ready(gmax4002->dev, "stop",
+                 gmax4002_timing_record(gmax4002, GMAX4002_TIMING_STOP,
+                            start),
+                 ret);
+    return ret;
 }
 
+/*
+ * Quiesce the sensor but keep it powered and clocked. The register file is
+ * retained, so the next stream only has to redo the analog power up. That
+ * expects the state configure leaves: STREAM_EN cleared by the stop,
+ * CLK_STABLE_EN still set, PWR_UP_EN cleared and the handshake registers
+ * back at their table values.
+ */
+static int gmax4002_enter_standby(struct gmax4002 *gmax4002)
+{
+    int ret;
 
+    gmax4002->analog_on = false;
 
-/* --------------------------------------------------------------------------
- * Stream on/off
- * --------------------------------------------------------------------------
+    //PWR_UP_EN = 0
+    ret = cci_write(gmax4002->regmap, GMAX4002_REG_PWR_UP, 0, NULL);
+    if (!ret)
+        ret = gmax4002_restore_handshake(gmax4002);
+    if (ret) {
+        gmax4002->configured = false;
+        gmax4002->programmed_mode = NULL;
+    }
+
+    return ret;
+}
+
+/* Second standby stage: drop the reference so autosuspend powers off */
+static void gmax4002_standby_work(struct work_struct *work)
+{
+    struct gmax4002 *gmax4002 = container_of(to_delayed_work(work),
+                         struct gmax4002, standby_work);
+    struct v4l2_subdev_state *state;
+
+    state = v4l2_subdev_lock_and_get_active_state(&gmax4002->sd);
+    if (gmax4002->standby_ref) {
+        gmax4002->standby_ref = false;
+        pm_runtime_mark_last_busy(gmax4002->dev);
+        pm_runtime_put_autosuspend(gmax4002->dev);
+    }
+    v4l2_subdev_unlock_state(state);
+}
+
+/*
+ * The embedded line changes the stream for every receiver, so it is only
+ * sent while the metadata pad is streamed. A start of the image pad writes
+ * the current state, this covers a powered sensor in either order.
  */
+static int gmax4002_set_embedded(struct gmax4002 *gmax4002, bool on)
+{
+    int ret;
+
+    gmax4002->embedded = on;
+    if (!pm_runtime_active(gmax4002->dev))
+        return 0;
+
+    ret = gmax4002_write(gmax4002, GMAX4002_REG_EMBEDDED_CTRL,
+                 on ? GMAX4002_EMBEDDED_EN : 0, NULL);
+    if (ret)
+        dev_err(gmax4002->dev, "Failed to switch embedded data (%d)\n", ret);
+    return ret;
+}
 
 static int gmax4002_enable_streams(struct v4l2_subdev *sd,
                  struct v4l2_subdev_state *state, u32 pad,
                  u64 streams_mask)
 {
     struct gmax4002 *gmax4002 = to_gmax4002(sd);
-    const struct gmax4002_mode *mode_list, *mode;
+    const struct gmax4002_mode *mode;
     struct v4l2_mbus_framefmt *fmt;
-    unsigned int n_modes;
+    const struct v4l2_rect *crop;
+    ktime_t start = ktime_get();
+    ktime_t setup;
+    bool hot;
     int ret;
 
-    ret = pm_runtime_get_sync(gmax4002->dev);
-    if (ret < 0) {
-        pm_runtime_put_noidle(gmax4002->dev);
-        return ret;
-    }
+    /* The embedded line and low gain image go with the image */
+    if (pad == GMAX4002_PAD_METADATA)
+        return gmax4002_set_embedded(gmax4002, true);
+    if (pad != GMAX4002_PAD_IMAGE)
+        return 0;
 
-    ret = cci_multi_reg_write(gmax4002->regmap, mode_common_regs,
-                  ARRAY_SIZE(mode_common_regs), NULL);
-    if (ret) {
-        dev_err(gmax4002->dev, "Failed to write common settings\n");
-        goto err_rpm_put;
+    if (gmax4002->standby_ref) {
+        /* Resume from standby, the reference of the last stream is held */
+        cancel_delayed_work(&gmax4002->standby_work);
+        gmax4002->standby_ref = false;
+    } else {
+        ret = pm_runtime_get_sync(gmax4002->dev);
+        if (ret < 0) {
+            pm_runtime_put_noidle(gmax4002->dev);
+            return ret;
+        }
     }
 
-    usleep_range(10000,12000);
-    //CLK_STABLE_EN = 1
-    cci_update_bits(gmax4002->regmap, CCI_REG8(0x2E00), BIT(0), BIT(0), &ret);
-    //PWR_UP_EN = 1
-    cci_write(gmax4002->regmap, CCI_REG8(0x3301), 0x01, &ret);
+    /* No flush of an earlier batch may run into the configure below */
+    mutex_lock(&gmax4002->flush_lock);
+    if (gmax4002->flush_failed) {
+        gmax4002->flush_failed = false;
+        gmax4002->configured = false;
+        gmax4002->programmed_mode = NULL;
+    }
 
-    // > 80ms
-    usleep_range(100000,101000);
-    /* D<0x3024>_Bit<5>=0 */
-    cci_update_bits(gmax4002->regmap, CCI_REG8(0x3024), BIT(5), 0, &ret);
-    /* D<0x3023>_Bit<7:4>=b'1111 */
-    cci_update_bits(gmax4002->regmap, CCI_REG8(0x3023), GENMASK(7, 4),FIELD_PREP(GENMASK(7, 4), 0xF), &ret);
-    /* D<0x3023>_Bit<0>=1 */
-    cci_update_bits(gmax4002->regmap, CCI_REG8(0x3023), BIT(0), BIT(0), &ret);
-    /* D<0x3023>_Bit<2:1>=2'b11 */
-    cci_update_bits(gmax4002->regmap, CCI_REG8(0x3023), GENMASK(2, 1),FIELD_PREP(GENMASK(2, 1), 0x3), &ret);
-    /* D<0x3024>_Bit<5>=1 */
-    cci_update_bits(gmax4002->regmap, CCI_REG8(0x3024), BIT(5), BIT(5), &ret);
-    /* D<0x3023>_Bit<2>=0 */
-    cci_update_bits(gmax4002->regmap, CCI_REG8(0x3023), BIT(2), 0, &ret);
+    fmt = v4l2_subdev_state_get_format(state, GMAX4002_PAD_IMAGE);
+    crop = v4l2_subdev_state_get_crop(state, GMAX4002_PAD_IMAGE);
+    mode = gmax4002_state_mode(gmax4002, fmt, crop);
+
+    /* Registers survived since the last upload: only restart streaming */
+    hot = gmax4002->configured && gmax4002->programmed_mode == mode &&
+          gmax4002->analog_on;
+    if (!hot) {
+        if (!gmax4002->configured || gmax4002->programmed_mode != mode) {
+            ret = gmax4002_configure(gmax4002, mode);
+            if (ret)
+                goto err_rpm_put;
+        }
+
+        /* A scaling-only switch on a configured sensor leaves the analog side up */
+        if (!gmax4002->analog_on) {
+            ret = gmax4002_power_up_analog(gmax4002);
+            if (ret)
+                goto err_rpm_put;
+        }
+    }
 
-    //STREAM_EN = 1
-    cci_update_bits(gmax4002->regmap, CCI_REG8(0x2E00), BIT(1), BIT(1), &ret);
+    /* The last stop left STREAM_EN cleared, a hot start reprograms as is */
 
+    /* Embedded line as the metadata pad wants it, then the readout window */
+    ret = 0;
+    gmax4002_write(gmax4002, GMAX4002_REG_EMBEDDED_CTRL,
+               gmax4002->embedded ? GMAX4002_EMBEDDED_EN : 0, &ret);
+    gmax4002_write(gmax4002, GMAX4002_REG_ROI_Y_START, crop->top, &ret);
+    gmax4002_write(gmax4002, GMAX4002_REG_ROI_Y_SIZE, crop->height, &ret);
+    if (!ret)
+        ret = gmax4002_reset_frames(gmax4002);
+
+    /*
+     * A master holds STREAM_EN and XVS back until its slaves are armed,
+     * the sync work sets both.
+     */
+    if (gmax4002->sync_role == GMAX4002_SYNC_ROLE_MASTER) {
+        cci_write(gmax4002->regmap, GMAX4002_REG_SYNC_OUT, 0, &ret);
+        gmax4002->sync_out = false;
+    } else {
+        //STREAM_EN = 1
+        cci_update_bits(gmax4002->regmap, GMAX4002_REG_CTRL0,
+                GMAX4002_STREAM_EN, GMAX4002_STREAM_EN, &ret);
+    }
+    if (ret) {
+        gmax4002->configured = false;
+        gmax4002->programmed_mode = NULL;
+        goto err_rpm_put;
+    }
 
     /* Apply user controls after writing the base tables */
+    setup = ktime_get();
     ret = __v4l2_ctrl_handler_setup(gmax4002->sd.ctrl_handler);
     if (ret) {
         dev_err(gmax4002->dev, "Control handler setup failed\n");
-        goto err_rpm_put;
+        goto err_stop;
+    }
+    gmax4002_timing_record(gmax4002, GMAX4002_TIMING_CTRL_SETUP, setup);
+
+    /* Step 0 of an armed burst applies to the first frame */
+    if (gmax4002->burst_armed) {
+        gmax4002->burst_armed = false;
+        gmax4002->burst_pos = 0;
+        atomic_set(&gmax4002->burst_due, 0);
+        WRITE_ONCE(gmax4002->burst_active, true);
+        gmax4002_burst_step(gmax4002, 0);
+    }
+
+    /* The controls are only queued, write them before the first frame */
+    ret = __gmax4002_flush_ctrls(gmax4002);
+    if (ret)
+        goto err_stop;
+
+    if (!hot) {
+        ret = gmax4002_wait_ready(gmax4002, GMAX4002_READY_STREAM);
+        if (ret)
+            goto err_stop;
     }
 
-    dev_info(gmax4002->dev, "Streaming started\n");
-    usleep_range(GMAX4002_STREAM_DELAY_US,
-             GMAX4002_STREAM_DELAY_US + GMAX4002_STREAM_DELAY_RANGE_US);
+    trace_gmax4002_stream_start(gmax4002->dev, hot);
 
-    /* vflip cannot change during streaming */
+    /* vflip and the sync mode cannot change during streaming */
     __v4l2_ctrl_grab(gmax4002->vflip, true);
     __v4l2_ctrl_grab(gmax4002->hflip, true);
+    __v4l2_ctrl_grab(gmax4002->sync_ctrl, true);
+    __v4l2_ctrl_grab(gmax4002->link_freq, true);
+    __v4l2_ctrl_grab(gmax4002->hdr, true);
+    __v4l2_ctrl_grab(gmax4002->overlap, true);
+
+    if (gmax4002->trigger_gpio)
+        enable_irq(gmax4002->trigger_irq);
 
+    gmax4002_sync_arm(gmax4002, true);
+
+    mutex_unlock(&gmax4002->flush_lock);
+    gmax4002_timing_record(gmax4002, GMAX4002_TIMING_STREAM_ON, start);
     return 0;
 
+err_stop:
+    gmax4002_stop_streaming(gmax4002);
 err_rpm_put:
+    mutex_unlock(&gmax4002->flush_lock);
     pm_runtime_put_autosuspend(gmax4002->dev);
     return ret;
 }
@@ -959,16 +3581,186 @@ static int gmax4002_disable_streams(struct v4l2_subdev *sd,
                   u64 streams_mask)
 {
     struct gmax4002 *gmax4002 = to_gmax4002(sd);
-    int ret;
+    int ret = 0;
+
+    if (pad == GMAX4002_PAD_METADATA)
+        return gmax4002_set_embedded(gmax4002, false);
+    if (pad != GMAX4002_PAD_IMAGE)
+        return 0;
+
+    if (gmax4002->trigger_gpio)
+        disable_irq(gmax4002->trigger_irq);
+    /* A pending step sees this and does nothing */
+    WRITE_ONCE(gmax4002->burst_active, false);
+    /* A queued batch is written after the stop, not during it */
+    mutex_lock(&gmax4002->flush_lock);
+
+    gmax4002_sync_arm(gmax4002, false);
+    if (gmax4002->sync_out) {
+        cci_write(gmax4002->regmap, GMAX4002_REG_SYNC_OUT, 0, NULL);
+        gmax4002->sync_out = false;
+    }
 
     __v4l2_ctrl_grab(gmax4002->vflip, false);
     __v4l2_ctrl_grab(gmax4002->hflip, false);
+    __v4l2_ctrl_grab(gmax4002->sync_ctrl, false);
+    __v4l2_ctrl_grab(gmax4002->link_freq, false);
+    __v4l2_ctrl_grab(gmax4002->hdr, false);
+    __v4l2_ctrl_grab(gmax4002->overlap, false);
+
+    /* Stopped but powered: a restart in the autosuspend window is hot */
+    ret = gmax4002_stop_streaming(gmax4002);
+
+    if (!ret && gmax4002->standby_timeout_ms) {
+        ret = gmax4002_enter_standby(gmax4002);
+        if (!ret) {
+            /* Keep the reference, the standby work drops it later */
+            gmax4002->standby_ref = true;
+            queue_delayed_work(system_wq, &gmax4002->standby_work,
+                       msecs_to_jiffies(gmax4002->standby_timeout_ms));
+            trace_gmax4002_stream_stop(gmax4002->dev, true);
+            mutex_unlock(&gmax4002->flush_lock);
+            return 0;
+        }
+    }
+    mutex_unlock(&gmax4002->flush_lock);
 
+    trace_gmax4002_stream_stop(gmax4002->dev, false);
+
+    pm_runtime_mark_last_busy(gmax4002->dev);
     pm_runtime_put_autosuspend(gmax4002->dev);
 
     return ret;
 }
 
+/* --------------------------------------------------------------------------
+ * Benchmark
+ * --------------------------------------------------------------------------
+ */
+
+static int gmax4002_timing_hist_show(struct seq_file *m, void *unused)
+{
+    struct gmax4002_timing *t = m->private;
+    u32 hist[GMAX4002_TIMING_BUCKETS];
+    unsigned long flags;
+    unsigned int i;
+
+    spin_lock_irqsave(&t->lock, flags);
+    memcpy(hist, t->hist, sizeof(hist));
+    spin_unlock_irqrestore(&t->lock, flags);
+
+    for (i = 0; i < GMAX4002_TIMING_BUCKETS; i++) {
+        if (!hist[i])
+            continue;
+        if (i == GMAX4002_TIMING_BUCKETS - 1)
+            seq_printf(m, ">= %u us: %u\n", 1U << (i - 1), hist[i]);
+        else
+            seq_printf(m, "< %u us: %u\n", 1U << i, hist[i]);
+    }
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(gmax4002_timing_hist);
+
+static int gmax4002_timing_reset_set(void *data, u64 val)
+{
+    struct gmax4002 *gmax4002 = data;
+    struct gmax4002_timing *t;
+    unsigned long flags;
+    unsigned int i;
+
+    for (i = 0; i < GMAX4002_TIMING_NUM; i++) {
+        t = &gmax4002->timing[i];
+        spin_lock_irqsave(&t->lock, flags);
+        t->last_us = 0;
+        t->min_us = 0;
+        t->max_us = 0;
+        t->count = 0;
+        memset(t->hist, 0, sizeof(t->hist));
+        spin_unlock_irqrestore(&t->lock, flags);
+    }
+
+    return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(gmax4002_timing_reset_fops, NULL,
+             gmax4002_timing_reset_set, "%llu\n");
+
+/*
+ * Run val power/stream cycles back to back: resume, start streaming on the
+ * active format, stop and suspend again without the standby or autosuspend
+ * delay. The cycles go through the subdev core so its stream bookkeeping
+ * stays right. Refused while the pipeline streams.
+ */
+static int gmax4002_bench_cycles_set(void *data, u64 val)
+{
+    struct gmax4002 *gmax4002 = data;
+    struct v4l2_subdev *sd = &gmax4002->sd;
+    struct v4l2_subdev_state *state;
+    bool busy;
+    int ret = 0;
+
+    if (!val || val > GMAX4002_BENCH_MAX_CYCLES)
+        return -EINVAL;
+
+    while (val-- && !ret) {
+        if (fatal_signal_pending(current))
+            return -EINTR;
+
+        state = v4l2_subdev_lock_and_get_active_state(sd);
+        busy = v4l2_subdev_is_streaming(sd);
+        v4l2_subdev_unlock_state(state);
+        if (busy)
+            return -EBUSY;
+
+        /* The core takes the state lock itself */
+        ret = v4l2_subdev_enable_streams(sd, GMAX4002_PAD_IMAGE, BIT(0));
+        if (ret == -EALREADY)
+            return -EBUSY;
+        if (ret)
+            break;
+
+        ret = v4l2_subdev_disable_streams(sd, GMAX4002_PAD_IMAGE, BIT(0));
+
+        state = v4l2_subdev_lock_and_get_active_state(sd);
+        if (gmax4002->standby_ref) {
+            cancel_delayed_work(&gmax4002->standby_work);
+            gmax4002->standby_ref = false;
+            pm_runtime_put_noidle(gmax4002->dev);
+        }
+        v4l2_subdev_unlock_state(state);
+
+        pm_runtime_suspend(gmax4002->dev);
+    }
+
+    return ret;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(gmax4002_bench_cycles_fops, NULL,
+             gmax4002_bench_cycles_set, "%llu\n");
+
+static void gmax4002_bench_debugfs_init(struct gmax4002 *gmax4002)
+{
+    struct gmax4002_timing *t;
+    struct dentry *dir, *phase;
+    unsigned int i;
+
+    dir = debugfs_create_dir("timing", gmax4002->debugfs);
+    for (i = 0; i < GMAX4002_TIMING_NUM; i++) {
+        t = &gmax4002->timing[i];
+        phase = debugfs_create_dir(gmax4002_timing_name(i), dir);
+        debugfs_create_u32("last_us", 0444, phase, &t->last_us);
+        debugfs_create_u32("min_us", 0444, phase, &t->min_us);
+        debugfs_create_u32("max_us", 0444, phase, &t->max_us);
+        debugfs_create_u32("count", 0444, phase, &t->count);
+        debugfs_create_file("histogram", 0444, phase, t,
+                    &gmax4002_timing_hist_fops);
+    }
+
+    debugfs_create_file_unsafe("reset", 0200, dir, gmax4002,
+                   &gmax4002_timing_reset_fops);
+    debugfs_create_file_unsafe("run_cycles", 0200, dir, gmax4002,
+                   &gmax4002_bench_cycles_fops);
+}
+
 /* --------------------------------------------------------------------------
  * Power / runtime PM
  * --------------------------------------------------------------------------
@@ -978,10 +3770,9 @@ static int gmax4002_power_on(struct device *dev)
 {
     struct v4l2_subdev *sd = dev_get_drvdata(dev);
     struct gmax4002 *gmax4002 = to_gmax4002(sd);
+    ktime_t start = ktime_get();
     int ret;
 
-    dev_info(gmax4002->dev, "power_on\n");
-
     ret = regulator_bulk_enable(GMAX4002_NUM_SUPPLIES, gmax4002->supplies);
     if (ret) {
         dev_err(gmax4002->dev, "Failed to enable regulators\n");
@@ -995,10 +3786,19 @@ static int gmax4002_power_on(struct device *dev)
     }
 
     gpiod_set_value_cansleep(gmax4002->reset_gpio, 1);
-    usleep_range(GMAX4002_XCLR_MIN_DELAY_US,
-             GMAX4002_XCLR_MIN_DELAY_US + GMAX4002_XCLR_DELAY_RANGE_US);
+    regcache_cache_only(gmax4002->regmap, false);
+    ret = gmax4002_wait_ready(gmax4002, GMAX4002_READY_XCLR);
+    if (ret)
+        goto clk_off;
+
+    gmax4002_timing_record(gmax4002, GMAX4002_TIMING_POWER_ON, start);
+    trace_gmax4002_power(gmax4002->dev, true);
     return 0;
 
+clk_off:
+    regcache_cache_only(gmax4002->regmap, true);
+    gpiod_set_value_cansleep(gmax4002->reset_gpio, 0);
+    clk_disable_unprepare(gmax4002->xclk);
 reg_off:
     regulator_bulk_disable(GMAX4002_NUM_SUPPLIES, gmax4002->supplies);
     return ret;
@@ -1009,7 +3809,18 @@ static int gmax4002_power_off(struct device *dev)
     struct v4l2_subdev *sd = dev_get_drvdata(dev);
     struct gmax4002 *gmax4002 = to_gmax4002(sd);
 
-    dev_info(gmax4002->dev, "power_off\n");
+    trace_gmax4002_power(gmax4002->dev, false);
+
+    /* Register contents are lost once the supplies drop, the cache keeps them */
+    gmax4002->configured = false;
+    gmax4002->analog_on = false;
+    regcache_cache_only(gmax4002->regmap, true);
+    regcache_mark_dirty(gmax4002->regmap);
+    gmax4002->cache_dirty = true;
+    /* The next stream start queues every control again */
+    spin_lock(&gmax4002->pending_lock);
+    gmax4002->num_pending = 0;
+    spin_unlock(&gmax4002->pending_lock);
 
     gpiod_set_value_cansleep(gmax4002->reset_gpio, 0);
     regulator_bulk_disable(GMAX4002_NUM_SUPPLIES, gmax4002->supplies);
@@ -1027,15 +3838,8 @@ static int gmax4002_get_selection(struct v4l2_subdev *sd,
                 struct v4l2_subdev_state *sd_state,
                 struct v4l2_subdev_selection *sel)
 {
-    struct gmax4002 *gmax4002 = to_gmax4002(sd);
-    const struct gmax4002_mode *mode_list, *mode;
-    const struct v4l2_mbus_framefmt *fmt;
-    unsigned int n_modes;
-
-    fmt = v4l2_subdev_state_get_format(sd_state, 0);
-    get_mode_table(gmax4002, fmt->code, &mode_list, &n_modes);
-    mode = v4l2_find_nearest_size(mode_list, n_modes, width, height,
-                                  fmt->width, fmt->height);
+    if (sel->pad != GMAX4002_PAD_IMAGE)
+        return -EINVAL;
 
     switch (sel->target) {
 
@@ -1055,7 +3859,7 @@ static int gmax4002_get_selection(struct v4l2_subdev *sd,
         return 0;
 
     case V4L2_SEL_TGT_CROP:
-        sel->r = *v4l2_subdev_state_get_crop(sd_state, 0);
+        sel->r = *v4l2_subdev_state_get_crop(sd_state, GMAX4002_PAD_IMAGE);
         return 0;
 
     default:
@@ -1063,13 +3867,140 @@ static int gmax4002_get_selection(struct v4l2_subdev *sd,
     }
 }
 
+static int gmax4002_set_selection(struct v4l2_subdev *sd,
+                struct v4l2_subdev_state *sd_state,
+                struct v4l2_subdev_selection *sel)
+{
+    struct gmax4002 *gmax4002 = to_gmax4002(sd);
+    struct v4l2_mbus_framefmt *format;
+    struct v4l2_rect rect;
+
+    if (sel->pad != GMAX4002_PAD_IMAGE || sel->target != V4L2_SEL_TGT_CROP)
+        return -EINVAL;
+
+    if (sel->which == V4L2_SUBDEV_FORMAT_ACTIVE && v4l2_subdev_is_streaming(sd))
+        return -EBUSY;
+
+    /* Only rows can be windowed, readout always spans the full width */
+    rect.left = GMAX4002_PIXEL_ARRAY_LEFT;
+    rect.width = GMAX4002_PIXEL_ARRAY_WIDTH;
+    rect.height = clamp_t(u32, ALIGN(sel->r.height, GMAX4002_ROI_Y_ALIGN),
+                  GMAX4002_ROI_MIN_HEIGHT, GMAX4002_PIXEL_ARRAY_HEIGHT);
+    rect.top = clamp_t(s32, sel->r.top, GMAX4002_PIXEL_ARRAY_TOP,
+               GMAX4002_PIXEL_ARRAY_TOP + GMAX4002_PIXEL_ARRAY_HEIGHT -
+               rect.height);
+    rect.top = ALIGN_DOWN(rect.top, GMAX4002_ROI_Y_ALIGN);
+
+    *v4l2_subdev_state_get_crop(sd_state, GMAX4002_PAD_IMAGE) = rect;
+    sel->r = rect;
+
+    /* The output follows the window, dummy rows included, unscaled */
+    format = v4l2_subdev_state_get_format(sd_state, GMAX4002_PAD_IMAGE);
+    format->width = rect.width;
+    format->height = rect.height + GMAX4002_DUMMY_ROWS;
+    *v4l2_subdev_state_get_format(sd_state, GMAX4002_PAD_HDR) = *format;
+
+    if (sel->which == V4L2_SUBDEV_FORMAT_ACTIVE) {
+        gmax4002->frame_width = format->width;
+        gmax4002->frame_height = format->height;
+        gmax4002_update_timing_ranges(gmax4002);
+        gmax4002_update_roi_ctrl(gmax4002, &rect);
+    }
+
+    return 0;
+}
+
+static u8 gmax4002_csi2_dt(unsigned int bpp)
+{
+    switch (bpp) {
+    case 8:
+        return MIPI_CSI2_DT_RAW8;
+    case 12:
+        return MIPI_CSI2_DT_RAW12;
+    default:
+        return MIPI_CSI2_DT_RAW10;
+    }
+}
+
+/* Channel, data type and size of what pad sends, false if it sends nothing */
+static bool gmax4002_frame_desc_entry(struct gmax4002 *gmax4002,
+                      struct v4l2_subdev_state *state,
+                      unsigned int pad,
+                      struct v4l2_mbus_frame_desc_entry *entry)
+{
+    const struct v4l2_mbus_framefmt *fmt;
+
+    fmt = v4l2_subdev_state_get_format(state, pad);
+    entry->pixelcode = fmt->code;
+
+    switch (pad) {
+    case GMAX4002_PAD_METADATA:
+        /* The embedded line is only sent while the metadata pad streams */
+        if (!media_pad_remote_pad_first(&gmax4002->pads[pad]))
+            return false;
+        entry->length = fmt->width * fmt->height;
+        entry->bus.csi2.vc = 0;
+        entry->bus.csi2.dt = MIPI_CSI2_DT_EMBEDDED_8B;
+        return true;
+    case GMAX4002_PAD_HDR:
+        /* Nothing on the second channel unless dual gain is on */
+        if (gmax4002->hdr->val != GMAX4002_HDR_DUAL_GAIN)
+            return false;
+        entry->bus.csi2.vc = GMAX4002_HDR_VC;
+        entry->bus.csi2.dt = gmax4002_csi2_dt(gmax4002_get_bpp(fmt->code));
+        return true;
+    default:
+        entry->bus.csi2.vc = 0;
+        entry->bus.csi2.dt = gmax4002_csi2_dt(gmax4002_get_bpp(fmt->code));
+        return true;
+    }
+}
+
+/*
+ * All pads share one CSI-2 link: the image and the embedded line on virtual
+ * channel 0, the low gain image of dual gain HDR on GMAX4002_HDR_VC. The
+ * image pad describes everything sent on the link, each entry tagged with
+ * its pad number as the stream, so a receiver linked to it alone sees the
+ * other channels too. The other pads describe only their own stream 0.
+ */
+static int gmax4002_get_frame_desc(struct v4l2_subdev *sd, unsigned int pad,
+                   struct v4l2_mbus_frame_desc *fd)
+{
+    struct gmax4002 *gmax4002 = to_gmax4002(sd);
+    struct v4l2_subdev_state *state;
+    unsigned int i;
+
+    if (pad >= GMAX4002_NUM_PADS)
+        return -EINVAL;
+
+    state = v4l2_subdev_lock_and_get_active_state(sd);
+
+    memset(fd, 0, sizeof(*fd));
+    fd->type = V4L2_MBUS_FRAME_DESC_TYPE_CSI2;
+    if (pad != GMAX4002_PAD_IMAGE) {
+        if (gmax4002_frame_desc_entry(gmax4002, state, pad, &fd->entry[0]))
+            fd->num_entries = 1;
+    } else {
+        for (i = 0; i < GMAX4002_NUM_PADS; i++) {
+            if (!gmax4002_frame_desc_entry(gmax4002, state, i,
+                               &fd->entry[fd->num_entries]))
+                continue;
+            fd->entry[fd->num_entries++].stream = i;
+        }
+    }
+
+    v4l2_subdev_unlock_state(state);
+
+    return 0;
+}
+
 static int gmax4002_init_state(struct v4l2_subdev *sd,
                  struct v4l2_subdev_state *state)
 {
     struct v4l2_rect *crop;
     struct v4l2_subdev_format fmt = {
         .which  = V4L2_SUBDEV_FORMAT_TRY,
-        .pad    = 0,
+        .pad    = GMAX4002_PAD_IMAGE,
         .format = {
             .code   = MEDIA_BUS_FMT_SRGGB10_1X10,
             .width  = GMAX4002_NATIVE_WIDTH,
@@ -1079,7 +4010,10 @@ static int gmax4002_init_state(struct v4l2_subdev *sd,
 
     gmax4002_set_pad_format(sd, state, &fmt);
 
-    crop = v4l2_subdev_state_get_crop(state, 0);
+    fmt.pad = GMAX4002_PAD_METADATA;
+    gmax4002_set_pad_format(sd, state, &fmt);
+
+    crop = v4l2_subdev_state_get_crop(state, GMAX4002_PAD_IMAGE);
     *crop = supported_modes_10bit[0].crop;
 
     return 0;
@@ -1090,6 +4024,27 @@ static int gmax4002_init_state(struct v4l2_subdev *sd,
  * --------------------------------------------------------------------------
  */
 
+static int gmax4002_subscribe_event(struct v4l2_subdev *sd, struct v4l2_fh *fh,
+                    struct v4l2_event_subscription *sub)
+{
+    struct gmax4002 *gmax4002 = to_gmax4002(sd);
+
+    switch (sub->type) {
+    case V4L2_EVENT_FRAME_SYNC:
+        /* Frame starts are only seen through the trigger input */
+        if (!gmax4002->trigger_gpio)
+            return -EINVAL;
+        return v4l2_event_subscribe(fh, sub, 8, NULL);
+    default:
+        return v4l2_ctrl_subdev_subscribe_event(sd, fh, sub);
+    }
+}
+
+static const struct v4l2_subdev_core_ops gmax4002_core_ops = {
+    .subscribe_event   = gmax4002_subscribe_event,
+    .unsubscribe_event = v4l2_event_subdev_unsubscribe,
+};
+
 static const struct v4l2_subdev_video_ops gmax4002_video_ops = {
     .s_stream = v4l2_subdev_s_stream_helper,
 };
@@ -1099,7 +4054,9 @@ static const struct v4l2_subdev_pad_ops gmax4002_pad_ops = {
     .get_fmt        = v4l2_subdev_get_fmt,
     .set_fmt        = gmax4002_set_pad_format,
     .get_selection  = gmax4002_get_selection,
+    .set_selection  = gmax4002_set_selection,
     .enum_frame_size = gmax4002_enum_frame_size,
+    .get_frame_desc  = gmax4002_get_frame_desc,
     .enable_streams  = gmax4002_enable_streams,
     .disable_streams = gmax4002_disable_streams,
 };
@@ -1109,6 +4066,7 @@ static const struct v4l2_subdev_internal_ops gmax4002_internal_ops = {
 };
 
 static const struct v4l2_subdev_ops gmax4002_subdev_ops = {
+    .core  = &gmax4002_core_ops,
     .video = &gmax4002_video_ops,
     .pad   = &gmax4002_pad_ops,
 };
@@ -1124,6 +4082,7 @@ static int gmax4002_check_hwcfg(struct device *dev, struct gmax4002 *gmax4002)
     struct v4l2_fwnode_endpoint ep = {
         .bus_type = V4L2_MBUS_CSI2_DPHY,
     };
+    unsigned int i, default_idx;
     int ret = -EINVAL;
 
     endpoint = fwnode_graph_get_next_endpoint(dev_fwnode(dev), NULL);
@@ -1137,12 +4096,28 @@ static int gmax4002_check_hwcfg(struct device *dev, struct gmax4002 *gmax4002)
         goto out_put;
     }
 
-    if (ep.bus.mipi_csi2.num_data_lanes != 4) {
-        dev_err(dev, "only 4 data lanes supported\n");
+    for (i = 0; i < ARRAY_SIZE(gmax4002_lane_cfgs); i++)
+        if (gmax4002_lane_cfgs[i].num_lanes ==
+            ep.bus.mipi_csi2.num_data_lanes)
+            gmax4002->lane_cfg = &gmax4002_lane_cfgs[i];
+    if (!gmax4002->lane_cfg) {
+        dev_err(dev, "only 2 or 4 data lanes supported\n");
         goto out_free;
     }
 
-    ret = 0;
+    ret = v4l2_link_freq_to_bitmap(dev, ep.link_frequencies,
+                       ep.nr_of_link_frequencies,
+                       gmax4002_link_freq_menu,
+                       ARRAY_SIZE(gmax4002_link_freq_menu),
+                       &gmax4002->link_freq_bitmap);
+    if (ret)
+        goto out_free;
+
+    default_idx = gmax4002->lane_cfg->link_freq_default_idx;
+    if (gmax4002->link_freq_bitmap & BIT(default_idx))
+        gmax4002->link_freq_idx = default_idx;
+    else
+        gmax4002->link_freq_idx = __ffs(gmax4002->link_freq_bitmap);
 
 out_free:
     v4l2_fwnode_endpoint_free(&ep);
@@ -1167,14 +4142,18 @@ static int gmax4002_check_module_exists(struct gmax4002 *gmax4002)
     int ret;
     u64 val;
 
-    /* No chip-id register; read a known register as a presence test */
+    /*
+     * No chip-id register: an ACKed read of BLKLEVEL only shows that
+     * something answers at the address, it does not identify the sensor.
+     */
     ret = cci_read(gmax4002->regmap, GMAX4002_REG_BLKLEVEL, &val, NULL);
     if (ret) {
-        dev_err(gmax4002->dev, "register read failed (%d)\n", ret);
+        dev_err(gmax4002->dev, "sensor not responding, BLKLEVEL read failed (%d)\n",
+            ret);
         return ret;
     }
 
-    dev_info(gmax4002->dev, "Sensor detected\n");
+    dev_info(gmax4002->dev, "Sensor responding\n");
     return 0;
 }
 
@@ -1185,6 +4164,7 @@ static int gmax4002_probe(struct i2c_client *client)
     unsigned int xclk_freq;
     int ret, i;
     const char *sync_mode;
+    const char *sync_role;
 
     gmax4002 = devm_kzalloc(dev, sizeof(*gmax4002), GFP_KERNEL);
     if (!gmax4002)
@@ -1192,20 +4172,76 @@ static int gmax4002_probe(struct i2c_client *client)
 
     v4l2_i2c_subdev_init(&gmax4002->sd, client, &gmax4002_subdev_ops);
     gmax4002->dev = dev;
+    gmax4002->mono = (uintptr_t)device_get_match_data(dev) == GMAX4002_VARIANT_MONO;
 
     ret = gmax4002_check_hwcfg(dev, gmax4002);
     if (ret)
         return ret;
 
-    gmax4002->regmap = devm_cci_regmap_init_i2c(client, 16);
+    gmax4002->regmap = devm_regmap_init_i2c(client, &gmax4002_regmap_config);
     if (IS_ERR(gmax4002->regmap))
-        return dev_err_probe(dev, PTR_ERR(gmax4002->regmap), "CCI init failed\n");
+        return dev_err_probe(dev, PTR_ERR(gmax4002->regmap), "regmap init failed\n");
+    /* Powered down until the first runtime resume */
+    regcache_cache_only(gmax4002->regmap, true);
+
+    ret = gmax4002_compile_table(dev, mode_common_regs,
+                     ARRAY_SIZE(mode_common_regs),
+                     &gmax4002->common_table);
+    if (ret)
+        return ret;
+
+    ret = gmax4002_compile_mode_deltas(gmax4002);
+    if (ret)
+        return ret;
 
     gmax4002->xclk = devm_clk_get(dev, NULL);
     if (IS_ERR(gmax4002->xclk))
         return dev_err_probe(dev, PTR_ERR(gmax4002->xclk), "xclk missing\n");
 
     xclk_freq = clk_get_rate(gmax4002->xclk);
+    if (xclk_freq != GMAX4002_XCLK_FREQ)
+        return dev_err_probe(dev, -EINVAL,
+                     "xclk frequency %u Hz not supported\n",
+                     xclk_freq);
+
+    gmax4002->bpp = 10;
+    gmax4002->frame_width = supported_modes_10bit[0].width;
+    gmax4002->frame_height = supported_modes_10bit[0].height;
+    gmax4002->sync_mode = GMAX4002_SYNC_EXT_EXPOSURE;
+    if (!device_property_read_string(dev, "sync-mode", &sync_mode)) {
+        ret = match_string(gmax4002_sync_mode_names,
+                   ARRAY_SIZE(gmax4002_sync_mode_names), sync_mode);
+        if (ret < 0)
+            return dev_err_probe(dev, ret, "invalid sync-mode \"%s\"\n",
+                         sync_mode);
+        gmax4002->sync_mode = ret;
+    }
+
+    gmax4002->sync_role = GMAX4002_SYNC_ROLE_NONE;
+    if (!device_property_read_string(dev, "gpixel,sync-role", &sync_role)) {
+        ret = match_string(gmax4002_sync_role_names,
+                   ARRAY_SIZE(gmax4002_sync_role_names), sync_role);
+        if (ret < 0)
+            return dev_err_probe(dev, ret, "invalid gpixel,sync-role \"%s\"\n",
+                         sync_role);
+        gmax4002->sync_role = ret;
+    }
+    if (gmax4002->sync_role == GMAX4002_SYNC_ROLE_MASTER)
+        gmax4002->sync_mode = GMAX4002_SYNC_MASTER;
+    else if (gmax4002->sync_role == GMAX4002_SYNC_ROLE_SLAVE)
+        gmax4002->sync_mode = GMAX4002_SYNC_EXT_TRIGGER;
+    device_property_read_u32(dev, "gpixel,sync-group", &gmax4002->sync_group);
+    device_property_read_u32(dev, "gpixel,trigger-delay-lines",
+                 &gmax4002->trigger_delay);
+    if (gmax4002->trigger_delay > GMAX4002_TRIG_DELAY_MAX)
+        return dev_err_probe(dev, -EINVAL, "gpixel,trigger-delay-lines out of range\n");
+    INIT_WORK(&gmax4002->sync_work, gmax4002_sync_work);
+    INIT_WORK(&gmax4002->burst_work, gmax4002_burst_work);
+    spin_lock_init(&gmax4002->pending_lock);
+    mutex_init(&gmax4002->flush_lock);
+    for (i = 0; i < GMAX4002_TIMING_NUM; i++)
+        spin_lock_init(&gmax4002->timing[i].lock);
+    INIT_WORK(&gmax4002->flush_work, gmax4002_flush_work);
 
     ret = gmax4002_get_regulators(gmax4002);
     if (ret)
@@ -1213,32 +4249,66 @@ static int gmax4002_probe(struct i2c_client *client)
 
     gmax4002->reset_gpio = devm_gpiod_get_optional(dev, "reset", GPIOD_OUT_HIGH);
 
-    /* Power on to probe the device */
-    ret = gmax4002_power_on(dev);
-    if (ret)
-        return ret;
+    gmax4002->trigger_gpio = devm_gpiod_get_optional(dev, "trigger", GPIOD_IN);
+    if (IS_ERR(gmax4002->trigger_gpio))
+        return dev_err_probe(dev, PTR_ERR(gmax4002->trigger_gpio),
+                     "failed to get trigger gpio\n");
+    if (gmax4002->trigger_gpio) {
+        gmax4002->trigger_irq = gpiod_to_irq(gmax4002->trigger_gpio);
+        if (gmax4002->trigger_irq < 0)
+            return dev_err_probe(dev, gmax4002->trigger_irq,
+                         "trigger gpio has no irq\n");
+
+        /* Only counted while streaming */
+        ret = devm_request_irq(dev, gmax4002->trigger_irq,
+                       gmax4002_trigger_irq,
+                       IRQF_TRIGGER_RISING | IRQF_NO_AUTOEN,
+                       dev_name(dev), gmax4002);
+        if (ret)
+            return dev_err_probe(dev, ret, "failed to request trigger irq\n");
+    }
 
-    ret = gmax4002_check_module_exists(gmax4002);
+    if (standby_timeout_ms >= 0)
+        gmax4002->standby_timeout_ms = standby_timeout_ms;
+    else
+        device_property_read_u32(dev, "gpixel,standby-timeout-ms",
+                     &gmax4002->standby_timeout_ms);
+    INIT_DELAYED_WORK(&gmax4002->standby_work, gmax4002_standby_work);
+
+    ret = gmax4002_init_gain_lut(gmax4002);
     if (ret)
-        goto err_power_off;
+        return ret;
 
-    pm_runtime_set_active(dev);
-    pm_runtime_get_noresume(dev);
+    /* Power on through runtime PM to probe the device */
     pm_runtime_enable(dev);
     pm_runtime_set_autosuspend_delay(dev, 1000);
     pm_runtime_use_autosuspend(dev);
 
+    ret = pm_runtime_resume_and_get(dev);
+    if (ret) {
+        dev_err_probe(dev, ret, "power on\n");
+        goto err_pm;
+    }
+
+    /* Presence check only, the sensor has no ID to verify */
+    ret = gmax4002_check_module_exists(gmax4002);
+    if (ret)
+        goto err_rpm_put;
+
     ret = gmax4002_init_controls(gmax4002);
     if (ret)
-        goto err_pm;
+        goto err_rpm_put;
 
-    gmax4002->sd.flags |= V4L2_SUBDEV_FL_HAS_DEVNODE;
+    gmax4002->sd.flags |= V4L2_SUBDEV_FL_HAS_DEVNODE | V4L2_SUBDEV_FL_HAS_EVENTS;
     gmax4002->sd.entity.function = MEDIA_ENT_F_CAM_SENSOR;
     gmax4002->sd.internal_ops = &gmax4002_internal_ops;
 
-    gmax4002->pad.flags = MEDIA_PAD_FL_SOURCE;
+    gmax4002->pads[GMAX4002_PAD_IMAGE].flags = MEDIA_PAD_FL_SOURCE;
+    gmax4002->pads[GMAX4002_PAD_METADATA].flags = MEDIA_PAD_FL_SOURCE;
+    gmax4002->pads[GMAX4002_PAD_HDR].flags = MEDIA_PAD_FL_SOURCE;
 
-    ret = media_entity_pads_init(&gmax4002->sd.entity, 1, &gmax4002->pad);
+    ret = media_entity_pads_init(&gmax4002->sd.entity, GMAX4002_NUM_PADS,
+                     gmax4002->pads);
     if (ret) {
         dev_err(dev, "entity pads init failed: %d\n", ret);
         goto err_ctrls;
@@ -1251,25 +4321,40 @@ static int gmax4002_probe(struct i2c_client *client)
         goto err_entity;
     }
 
+    gmax4002_sync_register(gmax4002);
+
     ret = v4l2_async_register_subdev_sensor(&gmax4002->sd);
     if (ret) {
-        dev_err(dev, "sensor subdev register failed: %d\n", ret);
-        goto err_entity;
+        dev_err_probe(dev, ret, "sensor subdev register\n");
+        goto err_sync;
     }
 
+    WRITE_ONCE(gmax4002->probed, true);
+
+    gmax4002_debugfs_init(gmax4002);
+    gmax4002_bench_debugfs_init(gmax4002);
+
     pm_runtime_mark_last_busy(dev);
     pm_runtime_put_autosuspend(dev);
     return 0;
 
+err_sync:
+    gmax4002_sync_unregister(gmax4002);
+    v4l2_subdev_cleanup(&gmax4002->sd);
 err_entity:
     media_entity_cleanup(&gmax4002->sd.entity);
 err_ctrls:
+    /* Nothing may run on the private data once devm frees it */
+    cancel_work_sync(&gmax4002->burst_work);
+    cancel_work_sync(&gmax4002->flush_work);
     gmax4002_free_controls(gmax4002);
+err_rpm_put:
+    pm_runtime_put_noidle(dev);
 err_pm:
     pm_runtime_disable(dev);
+    if (!pm_runtime_status_suspended(dev))
+        gmax4002_power_off(dev);
     pm_runtime_set_suspended(dev);
-err_power_off:
-    gmax4002_power_off(dev);
     return ret;
 }
 
@@ -1278,7 +4363,19 @@ static void gmax4002_remove(struct i2c_client *client)
     struct v4l2_subdev *sd = i2c_get_clientdata(client);
     struct gmax4002 *gmax4002 = to_gmax4002(sd);
 
+    /* Stop everything that queues work before cancelling it */
     v4l2_async_unregister_subdev(sd);
+    gmax4002_sync_unregister(gmax4002);
+    debugfs_remove_recursive(gmax4002->debugfs);
+    if (gmax4002->trigger_gpio)
+        devm_free_irq(gmax4002->dev, gmax4002->trigger_irq, gmax4002);
+
+    cancel_work_sync(&gmax4002->burst_work);
+    cancel_work_sync(&gmax4002->flush_work);
+    cancel_delayed_work_sync(&gmax4002->standby_work);
+    if (gmax4002->standby_ref)
+        pm_runtime_put_noidle(gmax4002->dev);
+
     v4l2_subdev_cleanup(sd);
     media_entity_cleanup(&sd->entity);
     gmax4002_free_controls(gmax4002);
@@ -1287,13 +4384,15 @@ static void gmax4002_remove(struct i2c_client *client)
     if (!pm_runtime_status_suspended(gmax4002->dev))
         gmax4002_power_off(gmax4002->dev);
     pm_runtime_set_suspended(gmax4002->dev);
+    mutex_destroy(&gmax4002->flush_lock);
 }
 
 static DEFINE_RUNTIME_DEV_PM_OPS(gmax4002_pm_ops, gmax4002_power_off,
                  gmax4002_power_on, NULL);
 
 static const struct of_device_id gmax4002_of_match[] = {
-    { .compatible = "gpixel,gmax4002" },
+    { .compatible = "gpixel,gmax4002", .data = (void *)GMAX4002_VARIANT_COLOUR },
+    { .compatible = "gpixel,gmax4002-mono", .data = (void *)GMAX4002_VARIANT_MONO },
     { /* sentinel */ }
 };
 MODULE_DEVICE_TABLE(of, gmax4002_of_match);
@@ -1303,6 +4402,7 @@ static struct i2c_driver gmax4002_i2c_driver = {
         .name  = "gmax4002",
         .pm    = pm_ptr(&gmax4002_pm_ops),
         .of_match_table = gmax4002_of_match,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
     },
     .probe  = gmax4002_probe,
     .remove = gmax4002_remove,
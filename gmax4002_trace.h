@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Tracepoints for the GMAX4002 driver, see
+ * /sys/kernel/tracing/events/gmax4002/.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM gmax4002
+
+#if !defined(_GMAX4002_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _GMAX4002_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* A control value queued for the sensor, the flush logs I2C errors */
+TRACE_EVENT(gmax4002_ctrl,
+    TP_PROTO(struct device *dev, u32 id, s32 val, int ret),
+    TP_ARGS(dev, id, val, ret),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __field(u32, id)
+        __field(s32, val)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        __assign_str(dev);
+        __entry->id = id;
+        __entry->val = val;
+        __entry->ret = ret;
+    ),
+    TP_printk("%s id=0x%x val=%d ret=%d", __get_str(dev),
+          __entry->id, __entry->val, __entry->ret)
+);
+
+/* Streaming started, hot when the register file was reused */
+TRACE_EVENT(gmax4002_stream_start,
+    TP_PROTO(struct device *dev, bool hot),
+    TP_ARGS(dev, hot),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __field(bool, hot)
+    ),
+    TP_fast_assign(
+        __assign_str(dev);
+        __entry->hot = hot;
+    ),
+    TP_printk("%s%s", __get_str(dev), __entry->hot ? " hot" : "")
+);
+
+/* Streaming stopped, standby when the sensor stays powered */
+TRACE_EVENT(gmax4002_stream_stop,
+    TP_PROTO(struct device *dev, bool standby),
+    TP_ARGS(dev, standby),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __field(bool, standby)
+    ),
+    TP_fast_assign(
+        __assign_str(dev);
+        __entry->standby = standby;
+    ),
+    TP_printk("%s%s", __get_str(dev), __entry->standby ? " standby" : "")
+);
+
+/* Supplies, clock and XCLR switched */
+TRACE_EVENT(gmax4002_power,
+    TP_PROTO(struct device *dev, bool on),
+    TP_ARGS(dev, on),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __field(bool, on)
+    ),
+    TP_fast_assign(
+        __assign_str(dev);
+        __entry->on = on;
+    ),
+    TP_printk("%s %s", __get_str(dev), __entry->on ? "on" : "off")
+);
+
+/* One power-up readiness phase, us from its start until ready */
+TRACE_EVENT(gmax4002_ready,
+    TP_PROTO(struct device *dev, const char *phase, u32 us, int ret),
+    TP_ARGS(dev, phase, us, ret),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __string(phase, phase)
+        __field(u32, us)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        __assign_str(dev);
+        __assign_str(phase);
+        __entry->us = us;
+        __entry->ret = ret;
+    ),
+    TP_printk("%s %s %u us ret=%d", __get_str(dev), __get_str(phase),
+          __entry->us, __entry->ret)
+);
+
+#endif /* _GMAX4002_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE gmax4002_trace
+#include <trace/define_trace.h>